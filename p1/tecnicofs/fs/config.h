@@ -4,14 +4,30 @@
 /* FS root inode number */
 #define ROOT_DIR_INUM (0)
 
+/* Default filesystem geometry, used by tfs_init(); a different geometry
+ * can be requested at startup through tfs_init_with_params() */
 #define BLOCK_SIZE (1024)
 #define DATA_BLOCKS (1024)
 #define INODE_TABLE_SIZE (50)
-#define MAX_OPEN_FILES (20)
+/* Number of independent allocation regions the i-node table is split
+ * into, so threads creating files in parallel don't all serialize on
+ * one table lock */
+#define INODE_TABLE_SHARDS (4)
+#define MAX_OPEN_FILES (64)
+/* Same idea as INODE_TABLE_SHARDS, for the open file table: open/close
+ * calls from different threads only contend within one shard */
+#define OPEN_FILE_SHARDS (4)
 #define MAX_FILE_NAME (40)
 
 #define DELAY (5000)
 
+/* How many blocks ahead of the cursor a sequential tfs_read stream
+ * resolves (and, on the mmap backend, prefetches), and how many
+ * back-to-back sequential reads a handle needs before readahead kicks
+ * in */
+#define READAHEAD_BLOCKS (8)
+#define READAHEAD_MIN_STREAK (2)
+
 #define MAX_FILE_BLOCKS (10)
 
 #endif // CONFIG_H
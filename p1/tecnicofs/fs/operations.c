@@ -1,12 +1,123 @@
 #include "operations.h"
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/* Pathname lookup cache: maps full paths straight to inumbers so repeat
+ * opens of the same hot names skip the component walk (and the simulated
+ * storage delay it pays per directory) entirely. Direct mapped, with
+ * negative entries (inumber == -1) so repeatedly probing a missing file
+ * is just as cheap. Entries are replaced whenever the name is (re)bound */
+#define LOOKUP_CACHE_BUCKETS (64)
+#define LOOKUP_CACHE_PATH (128)
+
+typedef struct {
+    bool lc_valid;
+    int lc_inumber;
+    char lc_path[LOOKUP_CACHE_PATH];
+} lookup_cache_entry_t;
+
+static lookup_cache_entry_t lookup_cache[LOOKUP_CACHE_BUCKETS];
+static pthread_rwlock_t lookup_cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*
+ * Hashes a full path into a cache bucket (djb2, same as the directory
+ * index in state.c)
+ */
+static size_t lookup_cache_hash(char const *name) {
+    size_t h = 5381;
+
+    for (char const *p = name; *p != '\0'; p++) {
+        h = h * 33 + (size_t)(unsigned char)*p;
+    }
+
+    return h % LOOKUP_CACHE_BUCKETS;
+}
+
+/*
+ * Probes the cache for a path. A hit can be negative: *inumber comes
+ * back as -1, meaning the name is known to not exist.
+ * Returns: 1 on a hit, 0 on a miss
+ */
+static int lookup_cache_get(char const *name, int *inumber) {
+    if (strlen(name) >= LOOKUP_CACHE_PATH) {
+        return 0;
+    }
+
+    if (pthread_rwlock_rdlock(&lookup_cache_lock) != 0) {
+        return 0;
+    }
+
+    lookup_cache_entry_t *entry = &lookup_cache[lookup_cache_hash(name)];
+    int hit = entry->lc_valid && strcmp(entry->lc_path, name) == 0;
+    if (hit) {
+        *inumber = entry->lc_inumber;
+    }
+
+    pthread_rwlock_unlock(&lookup_cache_lock);
+    return hit;
+}
+
+/*
+ * Remembers a path's resolution (inumber == -1 records that the name
+ * does not exist). On a bucket collision the old entry simply gets
+ * replaced: the cache is a best-effort shortcut, not a registry
+ */
+static void lookup_cache_put(char const *name, int inumber) {
+    if (strlen(name) >= LOOKUP_CACHE_PATH) {
+        return;
+    }
+
+    if (pthread_rwlock_wrlock(&lookup_cache_lock) != 0) {
+        return;
+    }
+
+    lookup_cache_entry_t *entry = &lookup_cache[lookup_cache_hash(name)];
+    entry->lc_valid = true;
+    entry->lc_inumber = inumber;
+    strcpy(entry->lc_path, name);
+
+    pthread_rwlock_unlock(&lookup_cache_lock);
+}
+
+/*
+ * Empties the whole cache; called whenever the filesystem is
+ * (re)initialized, since every cached resolution refers to the old tree
+ */
+static void lookup_cache_clear() {
+    if (pthread_rwlock_wrlock(&lookup_cache_lock) != 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < LOOKUP_CACHE_BUCKETS; i++) {
+        lookup_cache[i].lc_valid = false;
+    }
+
+    pthread_rwlock_unlock(&lookup_cache_lock);
+}
+
+
+int tfs_init() { return tfs_init_with_params(NULL); }
+
+int tfs_init_with_params(tfs_params const *params) {
+    lookup_cache_clear();
+
+    int ret = state_init_with_params(params);
+    if (ret == -1) {
+        return -1;
+    }
 
-int tfs_init() {
-    state_init();
+    if (ret == 1) {
+        /* An existing store was loaded: the root directory has to be in
+         * there already */
+        inode_t *root_inode = inode_get(ROOT_DIR_INUM);
+        if (root_inode == NULL || root_inode->i_node_type != T_DIRECTORY) {
+            return -1;
+        }
+        return 0;
+    }
 
     /* create root inode */
     int root = inode_create(T_DIRECTORY);
@@ -22,32 +133,128 @@ int tfs_destroy() {
     return 0;
 }
 
+int tfs_sync() { return state_sync(); }
+
+int tfs_export(char const *path) { return state_export(path); }
+
+int tfs_import(char const *path) {
+    lookup_cache_clear();
+
+    if (state_import(path) != 0) {
+        return -1;
+    }
+
+    /* A usable image has to carry the root directory */
+    inode_t *root_inode = inode_get(ROOT_DIR_INUM);
+    if (root_inode == NULL || root_inode->i_node_type != T_DIRECTORY) {
+        return -1;
+    }
+
+    return 0;
+}
+
 static bool valid_pathname(char const *name) {
     return name != NULL && strlen(name) > 1 && name[0] == '/';
 }
 
 
+/* Walks a path down from the root, resolving every component except the
+ * last one, so namespace operations in different subtrees only ever take
+ * their own directory's lock (find_in_dir read locks one directory at a
+ * time, never two at once).
+ * Inputs:
+ *   - name: absolute path name (must already be validated)
+ *   - last: set to the final component of the path
+ * Returns: the i-number of the directory that (should) contain the last
+ * component, -1 if some intermediate component is missing, is not a
+ * directory, or a component doesn't fit in MAX_FILE_NAME
+ */
+static int tfs_resolve_parent(char const *name, char const **last) {
+    int dir_inum = ROOT_DIR_INUM;
+    char const *cursor = name + 1; // skip the initial '/' character
+
+    for (;;) {
+        char const *slash = strchr(cursor, '/');
+        if (slash == NULL) {
+            break;
+        }
+
+        size_t len = (size_t)(slash - cursor);
+        if (len == 0 || len >= MAX_FILE_NAME) {
+            return -1;
+        }
+
+        /* find_in_dir needs the component NUL terminated */
+        char component[MAX_FILE_NAME];
+        memcpy(component, cursor, len);
+        component[len] = 0;
+
+        dir_inum = find_in_dir(dir_inum, component);
+        if (dir_inum == -1) {
+            return -1;
+        }
+
+        cursor = slash + 1;
+    }
+
+    size_t len = strlen(cursor);
+    if (len == 0 || len >= MAX_FILE_NAME) {
+        return -1;
+    }
+
+    *last = cursor;
+    return dir_inum;
+}
+
 int tfs_lookup(char const *name) {
     if (!valid_pathname(name)) {
         return -1;
     }
 
-    // skip the initial '/' character
-    name++;
+    int inum;
+    if (lookup_cache_get(name, &inum)) {
+        return inum;
+    }
 
-    return find_in_dir(ROOT_DIR_INUM, name);
+    char const *last;
+    int dir_inum = tfs_resolve_parent(name, &last);
+    if (dir_inum == -1) {
+        return -1;
+    }
+
+    inum = find_in_dir(dir_inum, last);
+    lookup_cache_put(name, inum);
+
+    return inum;
 }
 
 int tfs_open(char const *name, int flags) {
     int inum;
     size_t offset;
 
+    state_thread_stats()->open_calls++;
+
     /* Checks if the path name is valid */
     if (!valid_pathname(name)) {
         return -1;
     }
 
-    inum = tfs_lookup(name);
+    /* Resolves the containing directory once: the lookup and a possible
+     * create both hang off it. A cache hit skips the resolution (the
+     * parent is then only looked up if a create actually needs it) */
+    char const *last = NULL;
+    int parent_inum = -1;
+
+    if (!lookup_cache_get(name, &inum)) {
+        parent_inum = tfs_resolve_parent(name, &last);
+        if (parent_inum == -1) {
+            return -1;
+        }
+
+        inum = find_in_dir(parent_inum, last);
+        lookup_cache_put(name, inum);
+    }
+
     if (inum >= 0) {
         /* The file already exists */
 
@@ -109,17 +316,29 @@ int tfs_open(char const *name, int flags) {
         }
     } else if (flags & TFS_O_CREAT) {
         /* The file doesn't exist; the flags specify that it should be created*/
+
+        /* A negative cache hit got us here without resolving the parent */
+        if (parent_inum == -1) {
+            parent_inum = tfs_resolve_parent(name, &last);
+            if (parent_inum == -1) {
+                return -1;
+            }
+        }
+
         /* Create inode */
         inum = inode_create(T_FILE);
         if (inum == -1) {
             return -1;
         }
-        /* Add entry in the root directory */
-        if (add_dir_entry(ROOT_DIR_INUM, inum, name + 1) == -1) {
+        /* Add entry in the containing directory */
+        if (add_dir_entry(parent_inum, inum, last) == -1) {
             inode_delete(inum);
             return -1;
         }
 
+        /* Replaces a possible negative entry for the new name */
+        lookup_cache_put(name, inum);
+
         offset = 0;
     } else {
         return -1;
@@ -135,445 +354,776 @@ int tfs_open(char const *name, int flags) {
 }
 
 
-int tfs_close(int fhandle) { return remove_from_open_file_table(fhandle); }
-
-ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
-    /* Size of the remaining characters to write, in case the block
-     * isn't big enough */
-    size_t write_scraps = 0;
+int tfs_close(int fhandle) {
+    state_thread_stats()->close_calls++;
+    return remove_from_open_file_table(fhandle);
+}
 
-    /* Protect the "get_open_file_entry" function call */
-    if (of_rdlock(fhandle) == -1) {
+/* Maximum size (in bytes) a file can reach with the current mapping:
+ * all the direct blocks, a full indirect block and a full double
+ * indirect block (INDIR_BLOCK_SIZE indirect blocks worth of data) */
+#define MAX_FILE_SIZE                                                     \
+    ((MAX_FILE_BLOCKS + INDIR_BLOCK_SIZE +                                \
+      INDIR_BLOCK_SIZE * INDIR_BLOCK_SIZE) * fs_block_size)
+
+/* Allocates a data block to be used as a block of references (indirect
+ * or double indirect), with every entry initialized to -1 (empty).
+ * Returns: the block's number, -1 if allocation failed
+ */
+static int ref_block_alloc() {
+    int b = data_block_alloc();
+    if (b == -1) {
         return -1;
     }
 
-    open_file_entry_t *file = get_open_file_entry(fhandle);
-    if (file == NULL) {
-        of_unlock(fhandle);
+    int *temp = (int *)data_block_get(b);
+    if (temp == NULL) {
         return -1;
     }
 
-    /* "Store" the inumber in a variable so it can be used
-     * without accessing the file's struct fields */
-    int inumber = file->of_inumber;
-    
-    if (of_unlock(fhandle) == -1) {
-        return -1;
+    for (size_t i = 0; i < INDIR_BLOCK_SIZE; i++) {
+        temp[i] = -1;
     }
+    data_block_mark_dirty(b);
 
-    /* Protect the "inode_get" function call */
-    if (inode_rdlock(inumber) == -1) {
-        return -1;
-    }
+    return b;
+}
 
-    /* From the open file table entry, we get the inode */
-    inode_t *inode = inode_get(inumber);
-    if (inode == NULL) {
-        inode_unlock(inumber);
-        return -1;
-    }
+/* Resolves the data block that holds a given block of a file (the
+ * "file_block"-th block-sized slice of its contents), going through the
+ * direct references, the indirect block or the double indirect block as
+ * needed. The resolution itself is O(1) for any offset: the block index
+ * tells us directly which level and which entry to follow.
+ * When "alloc" is true, missing blocks (including the reference blocks
+ * themselves) are allocated on the way; the i-node must then be write
+ * locked by the caller. When "alloc" is false a read lock is enough.
+ * Inputs:
+ *   - inode: the file's i-node
+ *   - file_block: index of the block inside the file
+ *   - alloc: whether missing blocks should be allocated
+ * Returns: the data block's number, -1 if unallocated (and alloc is
+ * false), out of range, or allocation failed
+ */
+static int inode_block_lookup(inode_t *inode, size_t file_block, bool alloc) {
+    int *entry;
+
+    if (file_block < MAX_FILE_BLOCKS) {
+        /* The block is one of the direct references */
+        entry = &inode->i_data_blocks[file_block];
+    } else if (file_block < MAX_FILE_BLOCKS + INDIR_BLOCK_SIZE) {
+        /* The block lives in the indirect block, which may itself still
+         * need to be allocated and initialized */
+        if (inode->i_indir_block == -1) {
+            if (!alloc) {
+                return -1;
+            }
 
-    if (inode_unlock(inumber) == -1) {
-        return -1;
-    }
+            inode->i_indir_block = ref_block_alloc();
+            if (inode->i_indir_block == -1) {
+                return -1;
+            }
 
-    if (of_rdlock(fhandle) == -1) {
-        return -1;
-    }
+            inode->i_curr_indir = 0;
+        }
 
-    /* Finds the "true offset", since the offset is incremented the same
-     * way as the inode size (when it comes to tfs_write), the actual offset we
-     * want is the offset of the current block we are in, and so we find
-     * that value */
-    size_t number_of_blocks = file->of_offset / BLOCK_SIZE;
-    size_t real_offset = file->of_offset - number_of_blocks * BLOCK_SIZE;
+        int *temp = (int *)data_block_get(inode->i_indir_block);
+        if (temp == NULL) {
+            return -1;
+        }
 
-    if (of_unlock(fhandle) == -1) {
-        return -1;
-    }
+        entry = &temp[file_block - MAX_FILE_BLOCKS];
+        if (alloc) {
+            /* A write may rewrite this mapping entry in place */
+            data_block_mark_dirty(inode->i_indir_block);
+        }
+    } else if (file_block <
+               MAX_FILE_BLOCKS + INDIR_BLOCK_SIZE +
+               INDIR_BLOCK_SIZE * INDIR_BLOCK_SIZE) {
+        /* The block lives under the double indirect block: the outer
+         * entry references an indirect block, whose entry references the
+         * data block itself */
+        size_t idx = file_block - MAX_FILE_BLOCKS - INDIR_BLOCK_SIZE;
+
+        if (inode->i_dindir_block == -1) {
+            if (!alloc) {
+                return -1;
+            }
 
-    /* Determine how many bytes to write */
-    if (to_write + real_offset > BLOCK_SIZE) {
-        size_t temp = to_write;
-        to_write = BLOCK_SIZE - real_offset;
+            inode->i_dindir_block = ref_block_alloc();
+            if (inode->i_dindir_block == -1) {
+                return -1;
+            }
+        }
 
-        if (inode_rdlock(inumber) == -1) {
+        int *outer = (int *)data_block_get(inode->i_dindir_block);
+        if (outer == NULL) {
             return -1;
         }
 
-        /* If there are still blocks available for the rest of the data we want
-         * to write. If there are still indirect blocks available it means that
-         * there is atleast one data block available, whether that block is a 
-         * direct one or not, it doesn't matter to us now. (For some reason we have
-         * to make a cast to int for the "if" to work) */
-        if ((int) inode->i_curr_indir < (int) (INDIR_BLOCK_SIZE - 1)) {
-            write_scraps = temp - to_write;
+        if (outer[idx / INDIR_BLOCK_SIZE] == -1) {
+            if (!alloc) {
+                return -1;
+            }
+
+            outer[idx / INDIR_BLOCK_SIZE] = ref_block_alloc();
+            if (outer[idx / INDIR_BLOCK_SIZE] == -1) {
+                return -1;
+            }
+            data_block_mark_dirty(inode->i_dindir_block);
         }
 
-        if (inode_unlock(inumber) == -1) {
+        int *inner = (int *)data_block_get(outer[idx / INDIR_BLOCK_SIZE]);
+        if (inner == NULL) {
             return -1;
         }
+
+        entry = &inner[idx % INDIR_BLOCK_SIZE];
+        if (alloc) {
+            data_block_mark_dirty(outer[idx / INDIR_BLOCK_SIZE]);
+        }
+    } else {
+        /* Past what the mapping can address */
+        return -1;
     }
 
-    if (to_write > 0) {
-        /* Protects the next section of code from i-node reads/writes
-         * aswell as certain function calls */
-        if (inode_wrlock(inumber) == -1) {
+    if (*entry == -1) {
+        if (!alloc) {
             return -1;
         }
 
-        if (inode->i_size == 0) {
-            /* If empty file, i_curr_block is set to 0 */
-            inode->i_curr_block = 0;
+        *entry = data_block_alloc();
+    } else if (alloc && data_block_refcount(*entry) > 1) {
+        /* The block is shared with a clone and this caller is about to
+         * write it: give it a private copy first and drop our reference
+         * on the shared one (copy-on-write) */
+        int b = data_block_alloc();
+        if (b == -1) {
+            return -1;
         }
 
-        void *block = NULL;
-
-        /* If there are no more direct referenced blocks available, we must
-         * use the indirect one */
-        if (inode->i_curr_block == MAX_FILE_BLOCKS) {
-
-            /* If the inode doesn't have an indirect block, we initialize it */
-            if (inode->i_indir_block == -1) {
-                /* Allocates a new indirect data block */
-                inode->i_indir_block = data_block_alloc();
-                if (inode->i_indir_block == -1) {
-                    inode_unlock(inumber);
-                    return -1;
-                }
+        void *copy = data_block_get(b);
+        void *shared = data_block_get(*entry);
+        if (copy == NULL || shared == NULL) {
+            data_block_free(b);
+            return -1;
+        }
 
-                inode->i_curr_indir = 0;
+        memcpy(copy, shared, fs_block_size);
+        data_block_mark_dirty(b);
+        data_block_free(*entry);
+        *entry = b;
+    }
 
-                /* We get the indirect block */
-                int *temp = (int *)data_block_get(inode->i_indir_block);
-                if (temp == NULL) {
-                    inode_unlock(inumber);
-                    return -1;
-                }
+    return *entry;
+}
 
-                /* Initialize the indirect block's content as -1, meaning
-                 * it is currently empty */
-                for (size_t i = 0; i < INDIR_BLOCK_SIZE; i++) {
-                    temp[i] = -1;
-                } 
-            }
+/* Brings the i-node's block cursors (i_curr_block / i_curr_indir) up to
+ * date with its size, after a write may have grown the file. The cursors
+ * only ever grow, so overwrites of existing content leave them alone.
+ * Must be called with the i-node write locked.
+ */
+static void inode_update_cursors(inode_t *inode) {
+    /* Number of completely filled blocks */
+    size_t filled = inode->i_size / fs_block_size;
+
+    if (filled >= MAX_FILE_BLOCKS) {
+        inode->i_curr_block = MAX_FILE_BLOCKS;
+    } else if ((int)filled > inode->i_curr_block) {
+        inode->i_curr_block = (int)filled;
+    }
 
-            /* We get the indirect block */
-            int *temp = (int *)data_block_get(inode->i_indir_block);
-            if (temp == NULL) {
-                inode_unlock(inumber);
-                return -1;
-            }
+    if (inode->i_indir_block != -1 &&
+        inode->i_size > MAX_FILE_BLOCKS * fs_block_size) {
+        /* Number of indirect entries in use (a trailing partially filled
+         * block counts, so they are all freed with the i-node) */
+        size_t indir = (inode->i_size - MAX_FILE_BLOCKS * fs_block_size +
+                        fs_block_size - 1) / fs_block_size;
+        if (indir > INDIR_BLOCK_SIZE) {
+            indir = INDIR_BLOCK_SIZE;
+        }
 
-            /* We need to allocate a new block for the idirect block */
-            if (temp[inode->i_curr_indir] == -1) {
+        if ((int)indir > inode->i_curr_indir) {
+            inode->i_curr_indir = (int)indir;
+        }
+    }
+}
 
-                temp[inode->i_curr_indir] = data_block_alloc();
-                if (temp[inode->i_curr_indir] == -1) {
-                    inode_unlock(inumber);
-                    return -1;
-                }
-            }
+/* Performs the actual write of "to_write" bytes at the given file offset,
+ * shared between tfs_write and tfs_pwrite. Takes (and releases) the
+ * i-node's write lock itself: a single acquisition covers resolving every
+ * block the request touches and all the memcpys, instead of a lock round
+ * trip per block.
+ * Returns: the number of bytes written, -1 in case of error
+ */
+static ssize_t tfs_write_at(int inumber, void const *buffer, size_t to_write,
+                            size_t offset) {
+    if (inode_wrlock(inumber) == -1) {
+        return -1;
+    }
 
-            /* We finally get the block we need to write our data */
-            block = data_block_get(temp[inode->i_curr_indir]);
+    inode_t *inode = inode_get(inumber);
+    if (inode == NULL) {
+        inode_unlock(inumber);
+        return -1;
+    }
 
-            /* When write_scraps is greater than 0, it means we still have data
-             * to write, in other words, we need an extra block to write the rest
-             * of the data, and so, we increment i_curr_indir. If write_scraps is
-             * 0 but we filled a block, then we also increment i_curr_indir, since
-             * there is no more empty space in that block */
-            if (write_scraps > 0 || to_write + real_offset == BLOCK_SIZE) {
-                inode->i_curr_indir++;
-            }
+    /* The mapping may change under this write (new blocks, or a shared
+     * one replaced by its copy-on-write copy): bump the generation so
+     * readahead caches filled before it stop being trusted */
+    inode->i_wgen++;
 
-        }
-        else {
-            /* We still have direct referenced blocks to use */
-            if (inode->i_data_blocks[inode->i_curr_block] == -1) {
-                /* If the current data block is set to -1 we have to 
-                 * allocate it */
-                inode->i_data_blocks[inode->i_curr_block] = data_block_alloc();
-                if (inode->i_data_blocks[inode->i_curr_block] == -1) {
-                    inode_unlock(inumber);
-                    return -1;
-                }
-            }
+    /* Writes past the mapping's capacity are truncated */
+    if (offset >= MAX_FILE_SIZE) {
+        to_write = 0;
+    } else if (to_write > MAX_FILE_SIZE - offset) {
+        to_write = MAX_FILE_SIZE - offset;
+    }
 
-            block = data_block_get(inode->i_data_blocks[inode->i_curr_block]);
+    /* Transfers block-sized chunks until the request is done, resolving
+     * (and allocating) each block along the way */
+    size_t written = 0;
+    while (written < to_write) {
+        size_t pos = offset + written;
+        size_t block_offset = pos % fs_block_size;
 
-            /* Just like we did with the indirect block curr variable, we do the
-             * same with the direct block curr variable */
-            if (write_scraps > 0 || to_write + real_offset == BLOCK_SIZE) {
-                inode->i_curr_block++;
-            }
-            
+        size_t chunk = fs_block_size - block_offset;
+        if (chunk > to_write - written) {
+            chunk = to_write - written;
         }
 
-        if (inode_unlock(inumber) == -1) {
-            return -1;
+        int b = inode_block_lookup(inode, pos / fs_block_size, true);
+        if (b == -1) {
+            /* Ran out of blocks: return what was written so far */
+            break;
         }
 
+        void *block = data_block_get(b);
         if (block == NULL) {
-            return -1;
+            break;
         }
 
-        /* Perform the actual write */
-        memcpy(block + real_offset, buffer, to_write);
+        memcpy(block + block_offset, buffer + written, chunk);
+        data_block_mark_dirty(b);
+        written += chunk;
+    }
 
-        if (of_wrlock(fhandle) == -1) {
-            return -1;
-        }
-        /* The offset  and i-node size associated with the file handle are
-         * incremented accordingly */
-        file->of_offset += to_write;
+    /* When the write went past the old end of the file, its size grows
+     * accordingly (overwrites leave it alone) */
+    if (offset + written > inode->i_size) {
+        inode->i_size = offset + written;
+    }
 
-        if (inode_wrlock(inumber) == -1) {
-            return -1;
-        }
+    inode_update_cursors(inode);
 
-        if (file->of_offset < inode->i_size) {
-            /* When our offset is lesser than the i-node size, it means we
-             * are overwriting the block's content, and so, the i-node size 
-             * will stay the same (nothing to do here) */
-        }
-        else {
-            inode->i_size = file->of_offset;
-        }
+    if (inode_unlock(inumber) == -1) {
+        return -1;
+    }
 
-        if (inode_unlock(inumber) == -1) {
-            return -1;
-        }
+    return (ssize_t)written;
+}
 
-        if (of_unlock(fhandle) == -1) {
-            return -1;
-        }
+ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
 
-        /* If write_scraps is greater than 0 it means we still have data to
-         * write, and so we do a recursive call to finish writing the remaining
-         * data */
-        if (write_scraps > 0) {
-            tfs_write(fhandle, buffer + to_write, write_scraps);
-        }
+    /* Reserves the handle's next "to_write" bytes with a single
+     * fetch-add: concurrent sequential writers on the same handle get
+     * disjoint ranges, with no lock on the per-I/O path */
+    size_t offset = atomic_fetch_add(&file->of_offset, to_write);
+
+    ssize_t written = tfs_write_at(file->of_inumber, buffer, to_write, offset);
+
+    /* Gives back whatever part of the reservation couldn't be written
+     * (the file hit its maximum size, or an error occurred) */
+    size_t used = (written > 0) ? (size_t)written : 0;
+    if (used < to_write) {
+        atomic_fetch_sub(&file->of_offset, to_write - used);
     }
 
-    /* We return the true ammount of data we wrote to the file */
-    to_write += write_scraps;
+    thread_stats_t *stats = state_thread_stats();
+    stats->write_calls++;
+    stats->bytes_written += used;
 
-    return (ssize_t)to_write;
+    return written;
 }
 
+ssize_t tfs_pwrite(int fhandle, void const *buffer, size_t to_write,
+                   size_t offset) {
+    /* No lock needed: of_inumber is set before the handle is handed out
+     * and never changes while the file is open, and the handle's offset
+     * is neither read nor updated */
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
 
-ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
-    /* Size of the remaining characters to read, in case what we
-     * want to read is bigger than the block size */
-    size_t read_scraps = 0;
+    ssize_t written = tfs_write_at(file->of_inumber, buffer, to_write, offset);
 
-    /* Protect the "get_open_file_entry" funtion call */
+    thread_stats_t *stats = state_thread_stats();
+    stats->write_calls++;
+    stats->bytes_written += (written > 0) ? (size_t)written : 0;
+
+    return written;
+}
+
+
+/* Tries to answer a block resolution from the handle's readahead cache.
+ * Caller must hold the i-node's read lock; the cache is only trusted if
+ * its write generation still matches the i-node's, so block numbers
+ * resolved before a mapping change are never served.
+ * Returns: the data block's number, -1 on a cache miss
+ */
+static int readahead_lookup(int fhandle, inode_t const *inode,
+                            size_t file_block) {
     if (of_rdlock(fhandle) == -1) {
         return -1;
     }
 
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+
+    int b = -1;
+    if (file != NULL && file->of_ra_count > 0 &&
+        file->of_ra_wgen == inode->i_wgen &&
+        file_block >= file->of_ra_start &&
+        file_block < file->of_ra_start + (size_t)file->of_ra_count) {
+        b = file->of_ra_blocks[file_block - file->of_ra_start];
+    }
+
+    of_unlock(fhandle);
+    return b;
+}
+
+/* Sequential access detection, run after every tfs_read transfer (the
+ * caller still holds the i-node's read lock): when a handle's reads keep
+ * landing where the previous one ended, the next READAHEAD_BLOCKS block
+ * numbers are resolved ahead of the cursor, and on the mmap backend the
+ * blocks themselves are touched so the pages are in by the time the
+ * reader gets there
+ */
+static void readahead_advise(int fhandle, inode_t *inode, size_t offset,
+                             size_t bytes_read) {
+    if (of_wrlock(fhandle) == -1) {
+        return;
+    }
+
     open_file_entry_t *file = get_open_file_entry(fhandle);
     if (file == NULL) {
-        return -1;
+        of_unlock(fhandle);
+        return;
     }
 
-    /* Just like we did in "tfs_write", we do the same here */
-    int inumber = file->of_inumber;
+    if (offset == file->of_seq_next && bytes_read > 0) {
+        file->of_seq_streak++;
+    } else {
+        file->of_seq_streak = 0;
+        file->of_ra_count = 0;
+    }
+    file->of_seq_next = offset + bytes_read;
 
-    if (of_unlock(fhandle) == -1) {
-        return -1;
+    if (file->of_seq_streak >= READAHEAD_MIN_STREAK) {
+        size_t next_block = (offset + bytes_read + fs_block_size - 1) /
+                            fs_block_size;
+
+        file->of_ra_start = next_block;
+        file->of_ra_count = 0;
+        file->of_ra_wgen = inode->i_wgen;
+
+        for (int i = 0; i < READAHEAD_BLOCKS; i++) {
+            int b = inode_block_lookup(inode, next_block + (size_t)i,
+                                       false);
+            if (b == -1) {
+                break;
+            }
+
+            file->of_ra_blocks[file->of_ra_count++] = b;
+            data_block_prefetch(b);
+        }
     }
 
-    /* Protect the "inode_get" function call */
+    of_unlock(fhandle);
+}
+
+/* Performs the actual read of up to "len" bytes at the given file offset,
+ * shared between tfs_read and tfs_pread. Just like tfs_write_at, a single
+ * i-node (read) lock acquisition covers the whole transfer. When fhandle
+ * isn't -1, the handle's readahead cache answers resolutions it already
+ * has and gets refilled after sequential transfers.
+ * Returns: the number of bytes read, -1 in case of error
+ */
+static ssize_t tfs_read_at(int inumber, void *buffer, size_t len,
+                           size_t offset, int fhandle) {
     if (inode_rdlock(inumber) == -1) {
         return -1;
     }
 
-    /* From the open file table entry, we get the inode */
-    inode_t *inode = inode_get(file->of_inumber);
+    inode_t *inode = inode_get(inumber);
     if (inode == NULL) {
         inode_unlock(inumber);
         return -1;
     }
 
-    if (of_rdlock(fhandle) == -1) {
+    /* Determine how many bytes to read */
+    size_t to_read = 0;
+    if (offset < inode->i_size) {
+        to_read = inode->i_size - offset;
+    }
+    if (to_read > len) {
+        to_read = len;
+    }
+
+    /* Transfers block-sized chunks until the request is satisfied */
+    size_t bytes_read = 0;
+    while (bytes_read < to_read) {
+        size_t pos = offset + bytes_read;
+        size_t block_offset = pos % fs_block_size;
+
+        size_t chunk = fs_block_size - block_offset;
+        if (chunk > to_read - bytes_read) {
+            chunk = to_read - bytes_read;
+        }
+
+        /* The readahead cache resolves without re-walking the mapping
+         * (and without its storage delay); a miss falls back to the walk */
+        int b = -1;
+        if (fhandle != -1) {
+            b = readahead_lookup(fhandle, inode, pos / fs_block_size);
+        }
+        if (b == -1) {
+            b = inode_block_lookup(inode, pos / fs_block_size, false);
+        }
+        if (b == -1) {
+            break;
+        }
+
+        void *block = data_block_get(b);
+        if (block == NULL) {
+            break;
+        }
+
+        memcpy(buffer + bytes_read, block + block_offset, chunk);
+        bytes_read += chunk;
+    }
+
+    if (fhandle != -1) {
+        readahead_advise(fhandle, inode, offset, bytes_read);
+    }
+
+    if (inode_unlock(inumber) == -1) {
         return -1;
     }
 
-    /* Determine how many bytes to read */
-    size_t to_read = inode->i_size - file->of_offset;
-    
-    if (of_unlock(fhandle) == -1) {
+    return (ssize_t)bytes_read;
+}
+
+ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
         return -1;
     }
 
-    if (inode_unlock(inumber) == -1) {
+    /* Same reservation scheme as tfs_write: one fetch-add claims the
+     * range, and the part past the end of the file is given back */
+    size_t offset = atomic_fetch_add(&file->of_offset, len);
+
+    ssize_t bytes_read =
+        tfs_read_at(file->of_inumber, buffer, len, offset, fhandle);
+
+    size_t used = (bytes_read > 0) ? (size_t)bytes_read : 0;
+    if (used < len) {
+        atomic_fetch_sub(&file->of_offset, len - used);
+    }
+
+    thread_stats_t *stats = state_thread_stats();
+    stats->read_calls++;
+    stats->bytes_read += used;
+
+    return bytes_read;
+}
+
+ssize_t tfs_pread(int fhandle, void *buffer, size_t len, size_t offset) {
+    /* No lock needed, for the same reasons as tfs_pwrite: many threads
+     * can read disjoint regions of the same open file in parallel */
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
         return -1;
     }
 
-    if (to_read > len) {
-        to_read = len;
+    /* Positional reads jump around by design, so they neither consult
+     * nor train the handle's sequential readahead */
+    ssize_t bytes_read = tfs_read_at(file->of_inumber, buffer, len, offset, -1);
+
+    thread_stats_t *stats = state_thread_stats();
+    stats->read_calls++;
+    stats->bytes_read += (bytes_read > 0) ? (size_t)bytes_read : 0;
+
+    return bytes_read;
+}
+
+
+int tfs_copy_to_external_fs(char const *source_path, char const *dest_path) {
+    int fd = tfs_open(source_path, 0);
+    if (fd == -1) {
+        return -1;
     }
 
-    if (of_rdlock(fhandle) == -1) {
+    /* The open file entry already resolved the path, so there is no need
+     * for a second tfs_lookup */
+    open_file_entry_t *file = get_open_file_entry(fd);
+    if (file == NULL) {
+        tfs_close(fd);
+        return -1;
+    }
+    int inum = file->of_inumber;
+
+    /* Opens the file given as the des_path in write mode, if that file
+     * does not exist then it is created, if it does, all its content is
+     * erased and the file is considered as a new empty file (functionality
+     * already implemented by the fopen() function)
+     * - See: https://www.ibm.com/docs/en/i/7.1?topic=functions-fopen-open-files */
+    FILE *fp = fopen(dest_path, "w");
+    if (fp == NULL) {
+        tfs_close(fd);
         return -1;
     }
 
-    /* Finds the block where the offset is, aswell as the "actual"
-     * offset for that same block. (similar to the tfs_write "real_offset"
-     * logic) */
-    size_t offset_block = file->of_offset / BLOCK_SIZE;
-    size_t real_offset = file->of_offset - offset_block * BLOCK_SIZE;
+    /* Protect the "inode_get" function call (and keep the file stable for
+     * the whole copy) */
+    if (inode_rdlock(inum) == -1) {
+        fclose(fp);
+        tfs_close(fd);
+        return -1;
+    }
 
-    if (of_unlock(fhandle) == -1) {
+    inode_t *inode = inode_get(inum);
+    if (inode == NULL) {
+        inode_unlock(inum);
+        fclose(fp);
+        tfs_close(fd);
         return -1;
     }
 
-    /* Determine how many bytes to read */
-    if (to_read + real_offset > BLOCK_SIZE) {
-        size_t temp = to_read;
-        to_read = BLOCK_SIZE - real_offset;
+    /* Streams the file out one block at a time, writing straight from the
+     * data blocks: peak memory stays bounded no matter how big the file
+     * is, instead of staging the whole thing in a stack buffer */
+    size_t size = inode->i_size;
+    int failed = 0;
+    for (size_t pos = 0; pos < size; pos += fs_block_size) {
+        int b = inode_block_lookup(inode, pos / fs_block_size, false);
+        if (b == -1) {
+            failed = 1;
+            break;
+        }
 
-        if (inode_rdlock(inumber) == -1) {
-            return -1;
+        void *block = data_block_get(b);
+        if (block == NULL) {
+            failed = 1;
+            break;
         }
 
-        /* If there are still indirect blocks available it means that
-         * there is atleast one data block available, whether that block is a 
-         * direct one or not, it doesn't matter to us now. (For some reason we have
-         * to make a cast to int for the "if" to work) */
-        if ((int) inode->i_curr_indir < (int) (INDIR_BLOCK_SIZE - 1)) {
-            read_scraps = temp - to_read;
+        size_t chunk = fs_block_size;
+        if (chunk > size - pos) {
+            chunk = size - pos;
         }
 
-        if (inode_unlock(inumber) == -1) {
-            return -1;
+        if (fwrite(block, 1, chunk, fp) != chunk) {
+            failed = 1;
+            break;
         }
     }
 
-    if (to_read > 0) {
-        void *block = NULL;
+    if (inode_unlock(inum) == -1) {
+        failed = 1;
+    }
 
-        /* Protect the "data_block_get" function calls aswell as i-node reads */
-        if (inode_rdlock(inumber) == -1) {
-            return -1;
-        }
+    /* Close the external FS file */
+    if (fclose(fp) == EOF) {
+        failed = 1;
+    }
 
-        /* In case the offset block is one of the direct blocks */
-        if (offset_block < MAX_FILE_BLOCKS) {
-            block = data_block_get(inode->i_data_blocks[offset_block]);
-        }
-        else {
-            /* The offset block is an indirect one */
-            int *temp = (int *)data_block_get(inode->i_indir_block);
-            if (temp == NULL) {
-                inode_unlock(inumber);
-                return -1;
-            }
+    /* Close the TecnicoFS file */
+    if (tfs_close(fd) == -1) {
+        failed = 1;
+    }
+
+    return failed ? -1 : 0;
+}
 
-            block = data_block_get(temp[offset_block - MAX_FILE_BLOCKS]);
+/* Copies a file's block mapping into a freshly created i-node, taking an
+ * extra reference on every data block instead of copying its contents.
+ * The reference blocks (indirect / double indirect) are not shared: each
+ * clone gets its own, since writes rewrite their entries in place.
+ * Both i-nodes must be locked by the caller (source read, clone write).
+ * Returns: 0 if successful, -1 otherwise (the caller deletes the clone,
+ * which gives back whatever references were already taken)
+ */
+static int clone_block_mapping(inode_t const *src, inode_t *dst) {
+    /* The size goes in first: inode_delete() only walks the block
+     * mapping of an i-node whose size is non-zero, so if one of the
+     * steps below fails the clone's deletion must already see the size.
+     * The mapping entries not reached yet are still -1 (from
+     * inode_create / ref_block_alloc) and are skipped when freed */
+    dst->i_size = src->i_size;
+
+    for (size_t i = 0; i < MAX_FILE_BLOCKS; i++) {
+        if (src->i_data_blocks[i] != -1 &&
+            data_block_ref(src->i_data_blocks[i]) == -1) {
+            return -1;
         }
+        dst->i_data_blocks[i] = src->i_data_blocks[i];
+    }
+    dst->i_curr_block = src->i_curr_block;
 
-        if (inode_unlock(inumber) == -1) {
+    if (src->i_indir_block != -1) {
+        dst->i_indir_block = ref_block_alloc();
+        if (dst->i_indir_block == -1) {
             return -1;
         }
 
-        if (block == NULL) {
+        int *src_refs = (int *)data_block_get(src->i_indir_block);
+        int *dst_refs = (int *)data_block_get(dst->i_indir_block);
+        if (src_refs == NULL || dst_refs == NULL) {
             return -1;
         }
 
-        /* Perform the actual read */
-        memcpy(buffer, block + real_offset, to_read);
+        for (size_t i = 0; i < INDIR_BLOCK_SIZE; i++) {
+            if (src_refs[i] != -1 && data_block_ref(src_refs[i]) == -1) {
+                return -1;
+            }
+            dst_refs[i] = src_refs[i];
+        }
+        data_block_mark_dirty(dst->i_indir_block);
+        dst->i_curr_indir = src->i_curr_indir;
+    }
 
-        if (of_wrlock(fhandle) == -1) {
+    if (src->i_dindir_block != -1) {
+        dst->i_dindir_block = ref_block_alloc();
+        if (dst->i_dindir_block == -1) {
             return -1;
         }
 
-        /* The offset associated with the file handle is
-         * incremented accordingly */
-        file->of_offset += to_read;
-
-        if (of_unlock(fhandle) == -1) {
+        int *src_outer = (int *)data_block_get(src->i_dindir_block);
+        int *dst_outer = (int *)data_block_get(dst->i_dindir_block);
+        if (src_outer == NULL || dst_outer == NULL) {
             return -1;
         }
 
-        /* If read_scraps is greater than 0 it means we still have data to
-         * read, and so we do a recursive call to finish reading the remaining
-         * data */
-        if (read_scraps > 0) {
-            tfs_read(fhandle, buffer + to_read, read_scraps);
+        for (size_t i = 0; i < INDIR_BLOCK_SIZE; i++) {
+            if (src_outer[i] == -1) {
+                continue;
+            }
+
+            dst_outer[i] = ref_block_alloc();
+            if (dst_outer[i] == -1) {
+                return -1;
+            }
+
+            int *src_inner = (int *)data_block_get(src_outer[i]);
+            int *dst_inner = (int *)data_block_get(dst_outer[i]);
+            if (src_inner == NULL || dst_inner == NULL) {
+                return -1;
+            }
+
+            for (size_t j = 0; j < INDIR_BLOCK_SIZE; j++) {
+                if (src_inner[j] != -1 &&
+                    data_block_ref(src_inner[j]) == -1) {
+                    return -1;
+                }
+                dst_inner[j] = src_inner[j];
+            }
+            data_block_mark_dirty(dst_outer[i]);
         }
+        data_block_mark_dirty(dst->i_dindir_block);
     }
 
-    /* We return the true ammount of data we read from the file */
-    to_read += read_scraps;
-
-    return (ssize_t)to_read;
+    return 0;
 }
 
+int tfs_clone(char const *source_path, char const *dest_path) {
+    if (!valid_pathname(source_path) || !valid_pathname(dest_path)) {
+        return -1;
+    }
 
-int tfs_copy_to_external_fs(char const *source_path, char const *dest_path) {
-    int fd = tfs_open(source_path, 0);
-    if (fd == -1) {
+    int src_inum = tfs_lookup(source_path);
+    if (src_inum == -1) {
         return -1;
     }
 
-    int inum = tfs_lookup(source_path);
-    if (inum == -1) {
+    /* The destination must not exist: a clone never overwrites */
+    char const *dest_last;
+    int dest_parent = tfs_resolve_parent(dest_path, &dest_last);
+    if (dest_parent == -1 || find_in_dir(dest_parent, dest_last) != -1) {
         return -1;
     }
 
-    /* Protect the "inode_get" function call */
-    if (inode_rdlock(inum) == -1) {
+    int dst_inum = inode_create(T_FILE);
+    if (dst_inum == -1) {
         return -1;
-    } 
+    }
 
-    inode_t *inode = inode_get(inum);
-    if (inode == NULL) {
-        inode_unlock(inum);
+    /* The mapping is filled in before the name is linked, so nobody can
+     * open a half-built clone */
+    if (inode_rdlock(src_inum) == -1) {
+        inode_delete(dst_inum);
         return -1;
     }
 
-    size_t size = inode->i_size;
+    inode_t *src = inode_get(src_inum);
+    inode_t *dst = inode_get(dst_inum);
 
-    if (inode_unlock(inum) == -1) {
+    int failed = (src == NULL || dst == NULL ||
+                  src->i_node_type != T_FILE ||
+                  clone_block_mapping(src, dst) == -1);
+
+    if (inode_unlock(src_inum) == -1) {
+        failed = 1;
+    }
+
+    if (failed || add_dir_entry(dest_parent, dst_inum, dest_last) == -1) {
+        /* Deleting the clone hands back every reference it took */
+        inode_delete(dst_inum);
         return -1;
     }
 
-    /* Declare a buffer with enough space for all the file's content */
-    char buffer[size];
+    lookup_cache_put(dest_path, dst_inum);
+
+    return 0;
+}
 
-    /* Read the file's content and stores it in the buffer */
-    if (tfs_read(fd, buffer, size) != size) {
+int tfs_mkdir(char const *name) {
+    if (!valid_pathname(name)) {
         return -1;
     }
 
-    /* Opens the file given as the des_path in write mode, if that file
-     * does not exist then it is created, if it does, all its content is
-     * erased and the file is considered as a new empty file (functionality
-     * already implemented by the fopen() function)
-     * - See: https://www.ibm.com/docs/en/i/7.1?topic=functions-fopen-open-files */
-    FILE *fp = fopen(dest_path, "w");
-    if (fp == NULL) {
+    char const *last;
+    int parent_inum = tfs_resolve_parent(name, &last);
+    if (parent_inum == -1) {
         return -1;
     }
 
-    /* Perform the actua write to the file */
-    if (fwrite(buffer, 1, size, fp) != size) {
+    int inum = inode_create(T_DIRECTORY);
+    if (inum == -1) {
         return -1;
     }
-    
-    /* Close the external FS file */
-    if (fclose(fp) == EOF) {
+
+    /* add_dir_entry rejects a duplicate name, so a concurrent create of
+     * the same directory can't link it twice */
+    if (add_dir_entry(parent_inum, inum, last) == -1) {
+        inode_delete(inum);
         return -1;
     }
 
-    /* Close the TecnicoFS file */
-    if (tfs_close(fd) == -1) {
+    lookup_cache_put(name, inum);
+
+    return 0;
+}
+int tfs_get_stats(tfs_stats *stats) {
+    if (stats == NULL) {
         return -1;
     }
 
+    state_stats_aggregate(stats);
+
     return 0;
-}
\ No newline at end of file
+}
@@ -12,17 +12,51 @@ enum {
 };
 
 /*
- * Initializes tecnicofs
+ * Initializes tecnicofs with the default geometry from config.h
  * Returns 0 if successful, -1 otherwise.
  */
 int tfs_init();
 
+/*
+ * Initializes tecnicofs with the given geometry (block size, number of
+ * data blocks, i-node table size and open file table size), allocating
+ * the tables accordingly. A NULL params falls back to the config.h
+ * defaults.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_init_with_params(tfs_params const *params);
+
 /*
  * Destroy tecnicofs
  * Returns 0 if successful, -1 otherwise.
  */
 int tfs_destroy();
 
+/*
+ * Flushes the filesystem's persistent state to the backing file given in
+ * tfs_params (data blocks before metadata, so a crash in between never
+ * leaves the metadata pointing at unwritten contents). Does nothing when
+ * the filesystem is purely in-memory.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_sync();
+
+/*
+ * Serializes the whole filesystem (free maps, i-node table and data
+ * blocks) to a compact image file in one sequential pass. No operations
+ * may run concurrently with the export.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_export(char const *path);
+
+/*
+ * Restores the filesystem from an image written by tfs_export, adopting
+ * the image's geometry and discarding whatever the filesystem held
+ * before. Replaces the usual tfs_init() call on startup.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_import(char const *path);
+
 /*
  * Waits until no file is open and then destroy tecnicofs 
  * Returns 0 if successful, -1 otherwise.
@@ -31,14 +65,23 @@ int tfs_destroy_after_all_closed();
 
 
 /*
- * Looks for a file
- * Note: as a simplification, only a plain directory space (root directory only)
- * is supported Input:
+ * Looks for a file, resolving the path component by component from the
+ * root (nested directories created with tfs_mkdir are supported)
+ * Input:
  *  - name: absolute path name
  * Returns the inumber of the file, -1 if unsuccessful
  */
 int tfs_lookup(char const *name);
 
+/*
+ * Creates a directory. Every component of the path except the last must
+ * already exist and be a directory.
+ * Input:
+ *  - name: absolute path name of the new directory
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_mkdir(char const *name);
+
 /*
  * Opens a file
  * Input:
@@ -78,6 +121,33 @@ ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
  */
 ssize_t tfs_read(int fhandle, void *buffer, size_t len);
 
+/* Writes to an open file at an explicit offset, leaving the handle's own
+ * offset untouched, so concurrent positional writers on the same handle
+ * don't serialize on it
+ * Input:
+ * 	- file handle (obtained from a previous call to tfs_open)
+ * 	- buffer containing the contents to write
+ * 	- length of the contents (in bytes)
+ * 	- offset in the file where the write starts
+ * 	Returns the number of bytes that were written (can be lower than
+ * 	'len' if the maximum file size is exceeded), or -1 in case of error
+ */
+ssize_t tfs_pwrite(int fhandle, void const *buffer, size_t len, size_t offset);
+
+/* Reads from an open file at an explicit offset, leaving the handle's own
+ * offset untouched, so many threads can read disjoint regions of the same
+ * open file in parallel
+ * Input:
+ * 	- file handle (obtained from a previous call to tfs_open)
+ * 	- destination buffer
+ * 	- length of the buffer
+ * 	- offset in the file where the read starts
+ * 	Returns the number of bytes that were copied from the file to the buffer
+ * 	(can be lower than 'len' if the file size was reached), or -1 in case of
+ * error
+ */
+ssize_t tfs_pread(int fhandle, void *buffer, size_t len, size_t offset);
+
 /* Copies the contents of a file that exists in TecnicoFS to the contents
  * of another file in the OS' file system tree (outside TecnicoFS).
  * Devolve 0 em caso de sucesso, -1 em caso de erro.
@@ -89,4 +159,26 @@ ssize_t tfs_read(int fhandle, void *buffer, size_t len);
 */ 
 int tfs_copy_to_external_fs(char const *source_path, char const *dest_path);
 
+/* Duplicates a file inside TecnicoFS without copying its contents: the
+ * clone's i-node shares the source's data blocks through per-block
+ * reference counts, and a block is only really copied when either side
+ * writes it (copy-on-write).
+ * Input:
+ *      - path name of the source file
+ *      - path name of the clone, which must not exist yet
+ *      Returns 0 if successful, -1 otherwise.
+ */
+int tfs_clone(char const *source_path, char const *dest_path);
+
+/* Fills in the filesystem's statistics (see the tfs_stats struct in
+ * state.h): operation counts and bytes moved since initialization,
+ * allocator occupancy and cumulative lock-wait time. Always on and
+ * cheap to maintain: the counters are kept per thread and only summed
+ * here, so this can stay enabled in production.
+ * Input:
+ *      - address where the statistics are stored
+ *      Returns 0 if successful, -1 otherwise.
+ */
+int tfs_get_stats(tfs_stats *stats);
+
 #endif // OPERATIONS_H
@@ -1,754 +1,2020 @@
-#include "state.h"
-
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <pthread.h>
-
-
-/* Persistent FS state (in reality, it should be maintained in secondary
- * memory; for simplicity, this project maintains it in primary memory) */
-
-/* I-node table */
-static inode_t inode_table[INODE_TABLE_SIZE];
-static char freeinode_ts[INODE_TABLE_SIZE];
-/* rwlock used for protecting the i-node table */
-static pthread_rwlock_t i_table_rwlock;
-
-
-/* Data blocks */
-static char fs_data[BLOCK_SIZE * DATA_BLOCKS];
-static char free_blocks[DATA_BLOCKS];
-/* rwlock used for protecting the data block table */
-static pthread_rwlock_t data_block_rwlock;
-
-
-/* Volatile FS state */
-
-static open_file_entry_t open_file_table[MAX_OPEN_FILES];
-static char free_open_file_entries[MAX_OPEN_FILES];
-/* rwlock used for protecting the open file table */
-static pthread_rwlock_t of_table_rwlock;
-
- 
-static inline bool valid_inumber(int inumber) {
-    return inumber >= 0 && inumber < INODE_TABLE_SIZE;
-}
-
-static inline bool valid_block_number(int block_number) {
-    return block_number >= 0 && block_number < DATA_BLOCKS;
-}
-
-static inline bool valid_file_handle(int file_handle) {
-    return file_handle >= 0 && file_handle < MAX_OPEN_FILES;
-}
-
-/**
- * We need to defeat the optimizer for the insert_delay() function.
- * Under optimization, the empty loop would be completely optimized away.
- * This function tells the compiler that the assembly code being run (which is
- * none) might potentially change *all memory in the process*.
- *
- * This prevents the optimizer from optimizing this code away, because it does
- * not know what it does and it may have side effects.
- *
- * Reference with more information: https://youtu.be/nXaxk27zwlk?t=2775
- *
- * Exercise: try removing this function and look at the assembly generated to
- * compare.
- */
-static void touch_all_memory() { __asm volatile("" : : : "memory"); }
-
-/*
- * Auxiliary function to insert a delay.
- * Used in accesses to persistent FS state as a way of emulating access
- * latencies as if such data structures were really stored in secondary memory.
- */
-static void insert_delay() {
-    for (int i = 0; i < DELAY; i++) {
-        touch_all_memory();
-    }
-}
-
-/*
- * Initializes FS state
- */
-void state_init() {
-    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
-        freeinode_ts[i] = FREE;
-    }
-
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        free_blocks[i] = FREE;
-    }
-
-    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
-        free_open_file_entries[i] = FREE;
-    }
-
-    /* Initializes the i-node table rwlock for later use */
-    if (pthread_rwlock_init(&i_table_rwlock, NULL) != 0) { 
-        printf("state_init(): i-node table lock initialization failed\n");
-        return;
-    }
-
-    /* Initializes the data block table rwlock for later use */
-    if (pthread_rwlock_init(&data_block_rwlock, NULL) != 0) { 
-        printf("state_init(): data block table lock initialization failed\n");
-        return;
-    }
-
-    if (pthread_rwlock_init(&of_table_rwlock, NULL) != 0) { 
-        printf("state_init(): open file table lock initialization failed\n");
-        return;
-    }
-}
-
-void state_destroy() {
-    /* Destroys all the i-node's locks */
-    for (int inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
-        if (freeinode_ts[inumber] == TAKEN) {
-            if (pthread_rwlock_destroy(&inode_table[inumber].i_lock) != 0) {
-                printf("state_destroy(): inode lock destruction failed\n");
-                return;
-            }
-        }
-    }
-
-    /* Destroys all the open file's locks */
-    for (int fhandle = 0; fhandle < MAX_OPEN_FILES; fhandle++) {
-        if (free_open_file_entries[fhandle] == TAKEN) {
-            if (pthread_rwlock_destroy(&open_file_table[fhandle].of_lock) != 0) {
-                printf("state_destroy(): open file lock destruction failed\n");
-                return;
-            }
-        }
-    }
-
-    /* Destroys the table's locks */
-
-    if (pthread_rwlock_destroy(&i_table_rwlock) != 0) {
-        printf("state_destroy(): i-node table lock destruction failed\n");
-        return;
-    }
-
-    if (pthread_rwlock_destroy(&data_block_rwlock) != 0) {
-        printf("state_destroy(): data block table lock destruction failed\n");
-        return;
-    }
-
-    if (pthread_rwlock_destroy(&of_table_rwlock) != 0) {
-        printf("state_destroy(): open file table lock destruction failed\n");
-        return;
-    }
-}
-
-/*
- * Creates a new i-node in the i-node table.
- * Input:
- *  - n_type: the type of the node (file or directory)
- * Returns:
- *  new i-node's number if successfully created, -1 otherwise
- */
-int inode_create(inode_type n_type) {
-    if (pthread_rwlock_wrlock(&i_table_rwlock) != 0) {
-        return -1;
-    }
-
-    for (int inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
-        if ((inumber * (int) sizeof(allocation_state_t) % BLOCK_SIZE) == 0) {
-            insert_delay(); // simulate storage access delay (to freeinode_ts)
-        }
-
-        /* Finds first free entry in i-node table */
-        if (freeinode_ts[inumber] == FREE) {
-            /* Found a free entry, so takes it for the new i-node*/
-            freeinode_ts[inumber] = TAKEN;
-            insert_delay(); // simulate storage access delay (to i-node)
-
-            if (pthread_rwlock_unlock(&i_table_rwlock) != 0) {
-                return -1;
-            }
-
-            if (n_type == T_DIRECTORY) {
-                /* Initializes directory (filling its block with empty
-                 * entries, labeled with inumber == -1) */
-                int b = data_block_alloc();
-                if (b == -1) {
-                    pthread_rwlock_wrlock(&i_table_rwlock);
-
-                    freeinode_ts[inumber] = FREE;
-
-                    pthread_rwlock_unlock(&i_table_rwlock);
-                    return -1;
-                }
-
-                /* Initialize the i-node's rwlock */
-                if (pthread_rwlock_init(&inode_table[inumber].i_lock, NULL) != 0) {
-                    return -1;
-                }
-
-                /* Apply a write lock to the i-node to protect it while its being
-                 * initialized */
-                if (inode_wrlock(inumber) == -1) {
-                    return -1;
-                }
-
-                inode_table[inumber].i_node_type = n_type;
-
-                inode_table[inumber].i_size = BLOCK_SIZE;
-
-                /* Since the i-node is a directory we only use one of the data blocks,
-                 * the first one. */
-                inode_table[inumber].i_data_blocks[0] = b;
-                inode_table[inumber].i_curr_block = 0;
-
-                /* The remaining data blocks are initialized with -1, since they won't
-                 * be used */
-                for (size_t i = 1; i < MAX_FILE_BLOCKS; i++) {
-                    inode_table[inumber].i_data_blocks[i] = -1;
-                }
-                /* Likewise, the indirect block is also set to -1, as it won't be used */
-                inode_table[inumber].i_indir_block = -1;
-                inode_table[inumber].i_curr_indir = -1;
-
-                dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(b);
-                if (dir_entry == NULL) {
-                    pthread_rwlock_wrlock(&i_table_rwlock);
-
-                    freeinode_ts[inumber] = FREE;
-
-                    pthread_rwlock_unlock(&i_table_rwlock);
-                    inode_unlock(inumber);
-
-                    return -1;
-                }
-
-                for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-                    dir_entry[i].d_inumber = -1;
-                }
-
-                if (inode_unlock(inumber) == -1) {
-                    return -1;
-                }
-            } else {
-                /* Initialize the i-node's rwlock */
-                if (pthread_rwlock_init(&inode_table[inumber].i_lock, NULL) != 0) {
-                    return -1;
-                }
-
-                /* Apply a write lock to the i-node to protect it while its being
-                 * initialized */
-                if (inode_wrlock(inumber) == -1) {
-                    return -1;
-                }
-
-                inode_table[inumber].i_node_type = n_type;
-
-                /* In case of a new file, simply sets its size to 0 */
-                inode_table[inumber].i_size = 0;
-                
-                /* We initialize every data block entry with a -1, meaning they
-                 * are empty */
-                for (size_t i = 0; i < MAX_FILE_BLOCKS; i++) {
-                    inode_table[inumber].i_data_blocks[i] = -1;
-                }
-                /* the current data block is also initialized at -1, as we haven't
-                 * actually used the data blocks */
-                inode_table[inumber].i_curr_block = -1;
-
-                /* the indirect block is also set to -1 */
-                inode_table[inumber].i_indir_block = -1;
-                inode_table[inumber].i_curr_indir = -1;
-
-                if (inode_unlock(inumber)) {
-                    return -1;
-                }    
-            }
-
-            return inumber;
-        }
-    }
-
-    if (pthread_rwlock_unlock(&i_table_rwlock) != 0) {
-        return -1;
-    }
-
-    return -1;
-}
-
-/*
- * Deletes the i-node.
- * Input:
- *  - inumber: i-node's number
- * Returns: 0 if successful, -1 if failed
- */
-int inode_delete(int inumber) {
-    // simulate storage access delay (to i-node and freeinode_ts)
-    insert_delay();
-    insert_delay();
-
-    if (!valid_inumber(inumber) || freeinode_ts[inumber] == FREE) {
-        return -1;
-    }
-
-    if (pthread_rwlock_wrlock(&i_table_rwlock) != 0) {
-        return -1;
-    }
-
-    freeinode_ts[inumber] = FREE;
-
-    if (pthread_rwlock_unlock(&i_table_rwlock) != 0) {
-        return -1;
-    }
-
-    if (inode_rdlock(inumber) == -1) {
-        return -1;
-    }
-
-    if (inode_table[inumber].i_size > 0) {
-        if (inode_unlock(inumber) == -1) {
-            return -1;
-        }
-
-        /* Free all the data blocks associated with the inode */
-        if(free_inode_blocks(inumber) == -1) {
-            return -1;
-        }
-    }
-    else {
-        if (inode_unlock(inumber) == -1) {
-            return -1;
-        }
-    }
-
-    return 0;
-}
-
-/*
- * Returns a pointer to an existing i-node.
- * Input:
- *  - inumber: identifier of the i-node
- * Returns: pointer if successful, NULL if failed
- */
-inode_t *inode_get(int inumber) {
-    if (!valid_inumber(inumber)) {
-        return NULL;
-    }
-
-    insert_delay(); // simulate storage access delay to i-node
-    return &inode_table[inumber];
-}
-
-/*
- * Adds an entry to the i-node directory data.
- * Input:
- *  - inumber: identifier of the i-node
- *  - sub_inumber: identifier of the sub i-node entry
- *  - sub_name: name of the sub i-node entry
- * Returns: SUCCESS or FAIL
- */
-int add_dir_entry(int inumber, int sub_inumber, char const *sub_name) {
-    if (!valid_inumber(inumber) || !valid_inumber(sub_inumber)) {
-        return -1;
-    }
-
-    insert_delay(); // simulate storage access delay to i-node with inumber
-    if (inode_table[inumber].i_node_type != T_DIRECTORY) {
-        return -1;
-    }
-
-    if (strlen(sub_name) == 0) {
-        return -1;
-    }
-
-    /* Protect the "data_block_get" function call */
-    if (inode_rdlock(inumber) == -1) {
-        return -1;
-    }
-
-    /* Locates the block containing the directory's entries. Index 0, since
-     * we are dealing with a directory */
-    dir_entry_t *dir_entry =
-        (dir_entry_t *)data_block_get(inode_table[inumber].i_data_blocks[0]);
-    
-    if (dir_entry == NULL) {
-        inode_unlock(inumber);
-        return -1;
-    }
-
-    if (inode_unlock(inumber) == -1) {
-        return -1;
-    }
-
-    if (inode_wrlock(inumber) == -1) {
-        return -1;
-    }
-
-    /* Finds and fills the first empty entry */
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (dir_entry[i].d_inumber == -1) {
-            dir_entry[i].d_inumber = sub_inumber;
-            strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
-            dir_entry[i].d_name[MAX_FILE_NAME - 1] = 0;
-
-            if (inode_unlock(inumber) == -1) {
-                return -1;
-            }
-            return 0;
-        }
-	}
-
-    inode_unlock(inumber);
-    return -1;
-}
-
-/* Looks for a given name inside a directory
- * Input:
- * 	- parent directory's i-node number
- * 	- name to search
- * 	Returns i-number linked to the target name, -1 if not found
- */
-int find_in_dir(int inumber, char const *sub_name) {
-    insert_delay(); // simulate storage access delay to i-node with inumber
-    if (!valid_inumber(inumber) ||
-        inode_table[inumber].i_node_type != T_DIRECTORY) {
-        return -1;
-    }
-
-    /* We lock the i-node to protect it for the "data_block_get" function call */
-    if (inode_rdlock(inumber) == -1) {
-        return -1;
-    }
-
-    /* Locates the block containing the directory's entries. Index 0, since
-     * we are dealing with a directory */
-    dir_entry_t *dir_entry =
-        (dir_entry_t *)data_block_get(inode_table[inumber].i_data_blocks[0]);
-    if (dir_entry == NULL) {
-        inode_unlock(inumber);
-        return -1;
-    }
-
-    /* Iterates over the directory entries looking for one that
-     * has the target name */
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if ((dir_entry[i].d_inumber != -1) &&
-            (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
-            if (inode_unlock(inumber) == -1) {
-                return -1;
-            }
-
-            return dir_entry[i].d_inumber;
-        }
-    }
-
-    inode_unlock(inumber);
-    return -1;
-}
-
-/*
- * Allocated a new data block
- * Returns: block index if successful, -1 otherwise
- */
-int data_block_alloc() {
-	if (pthread_rwlock_wrlock(&data_block_rwlock) != 0) {
-        return -1;
-    }
-
-    for (int i = 0; i < DATA_BLOCKS; i++) {
-        if (i * (int) sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
-            insert_delay(); // simulate storage access delay to free_blocks
-        }
-        if (free_blocks[i] == FREE) {
-            free_blocks[i] = TAKEN;
-            if (pthread_rwlock_unlock(&data_block_rwlock) != 0) {
-                return -1;
-            }
-
-            return i;
-        }
-    }
-    
-	pthread_rwlock_unlock(&data_block_rwlock);
-    return -1;
-}
-
-/* Frees a data block
- * Input
- * 	- the block index
- * Returns: 0 if success, -1 otherwise
- */
-int data_block_free(int block_number) {
-    if (!valid_block_number(block_number)) {
-        return -1;
-    }
-
-    insert_delay(); // simulate storage access delay to free_blocks
-
-    if (pthread_rwlock_wrlock(&data_block_rwlock) != 0) {
-        return -1;
-    }
-
-    free_blocks[block_number] = FREE;
-
-    if (pthread_rwlock_unlock(&data_block_rwlock) != 0) {
-        return -1;
-    }
-
-	return 0;
-}
-
-/* Returns a pointer to the contents of a given block
- * Input:
- * 	- Block's index
- * Returns: pointer to the first byte of the block, NULL otherwise
- */
-void *data_block_get(int block_number) {
-    if (!valid_block_number(block_number)) {
-        return NULL;
-    }
-
-    insert_delay(); // simulate storage access delay to block
-
-    return &fs_data[block_number * BLOCK_SIZE];
-}
-
-/* Add new entry to the open file table
- * Inputs:
- * 	- I-node number of the file to open
- * 	- Initial offset
- * Returns: file handle if successful, -1 otherwise
- */
-int add_to_open_file_table(int inumber, size_t offset) {
-	if (pthread_rwlock_wrlock(&of_table_rwlock) != 0) {
-        return -1;
-    }
-
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (free_open_file_entries[i] == FREE) {
-            free_open_file_entries[i] = TAKEN;
-            
-            if (pthread_rwlock_unlock(&of_table_rwlock) != 0) {
-                return -1;
-            }
-
-            /* Initializes the rwlock for the open file for future usage */
-            if (pthread_rwlock_init(&open_file_table[i].of_lock, NULL) != 0) {
-                return -1;
-            }
-
-            /* We lock the open file to protect it during initialization */
-            if (of_wrlock(i) == -1) {
-                return -1;
-            }
-
-            open_file_table[i].of_inumber = inumber;
-            open_file_table[i].of_offset = offset;
-
-            if (of_unlock(i) == -1) {
-                return -1;
-            }
-
-            return i;
-        }
-    }
-
-	pthread_rwlock_unlock(&of_table_rwlock);
-    return -1;
-}
-
-/* Frees an entry from the open file table
- * Inputs:
- * 	- file handle to free/close
- * Returns 0 is success, -1 otherwise
- */
-int remove_from_open_file_table(int fhandle) {
-    if (!valid_file_handle(fhandle) ||
-        free_open_file_entries[fhandle] != TAKEN) {
-        return -1;
-    }
-
-    /* Since the file will be closed, we destroy the rwlock associated
-     * with it */
-    if (pthread_rwlock_destroy(&open_file_table[fhandle].of_lock) != 0) {
-       return -1;
-    }
-
-	if (pthread_rwlock_wrlock(&of_table_rwlock) != 0) {
-        return -1;
-    }
-
-    free_open_file_entries[fhandle] = FREE;
-
-    if (pthread_rwlock_unlock(&of_table_rwlock) != 0) {
-        return -1;
-    }
-
-    return 0;
-}
-
-/* Returns pointer to a given entry in the open file table
- * Inputs:
- * 	 - file handle
- * Returns: pointer to the entry if sucessful, NULL otherwise
- */
-open_file_entry_t *get_open_file_entry(int fhandle) {
-    if (!valid_file_handle(fhandle)) {
-        return NULL;
-    }
-
-    return &open_file_table[fhandle];
-}
-
-/* Frees all the data blocks associated with an i-node
- * Inputs:
- *   - inumber: i-node's number
- * Returns: 0 if successful -1 otherwise 
- */
-int free_inode_blocks(int inumber) {
-    if (!valid_inumber(inumber)) {
-        return -1;
-    }
-
-    if (inode_rdlock(inumber) == -1) {
-        return -1;
-    }
-
-    /* Free all the direct referenced data blocks associated with
-     * the inode */
-    for(size_t i = 0; i < MAX_FILE_BLOCKS; i++) {
-        if (data_block_free(inode_table[inumber].i_data_blocks[i]) == -1) {
-            inode_unlock(inumber);
-            return -1;
-        }
-    }
-
-    /* If we have an indirect block allocated we free it */
-    if (inode_table[inumber].i_indir_block != -1) {
-        /* We get the indirect block */
-        int *block = (int *)data_block_get(inode_table[inumber].i_indir_block);
-        if (block == NULL) {
-            inode_unlock(inumber);
-            return -1;
-        }
-		
-        /* Free all the blocks in the indirect block */
-        for (size_t i = 0; i < inode_table[inumber].i_curr_indir; i++) {
-            if (data_block_free(block[i]) == -1) {
-                inode_unlock(inumber);
-                return -1;
-            }
-        }
-
-        /* Free the data block itself */
-        if (data_block_free(inode_table[inumber].i_indir_block) == -1) {
-            inode_unlock(inumber);
-            return -1;
-        }
-    }
-
-    if (inode_unlock(inumber) == -1) {
-        return -1;
-    }
-
-    return 0;
-}
-
-/* Applies a read-lock to the i-node's rwlock
- * Inputs:
- *   - inumber: i-node's number
- * Returns: 0 if successful -1 otherwise 
- */
-int inode_rdlock(int inumber) {
-    if (!valid_inumber(inumber)) {
-        return -1;
-    }
-
-    if (pthread_rwlock_rdlock(&inode_table[inumber].i_lock) != 0) {
-        return -1;
-    }
-
-    return 0;
-}
-
-/* Applies a write-lock to the i-node's rwlock
- * Inputs:
- *   - inumber: i-node's number
- * Returns: 0 if successful -1 otherwise 
- */
-int inode_wrlock(int inumber) {
-    if (!valid_inumber(inumber)) {
-        return -1;
-    }
-
-    if (pthread_rwlock_wrlock(&inode_table[inumber].i_lock) != 0) {
-        return -1;
-    }
-
-    return 0;
-}
-
-/* Unlocks the i-node's rwlock
- * Inputs:
- *   - inumber: i-node's number
- * Returns: 0 if successful -1 otherwise 
- */
-int inode_unlock(int inumber) {
-    if (!valid_inumber(inumber)) {
-        return -1;
-    }
-
-    if (pthread_rwlock_unlock(&inode_table[inumber].i_lock) != 0) {
-        return -1;
-    }
-
-    return 0;
-}
-
-/* Applies a read-lock to the file's rwlock
- * Returns: 0 if successful -1 otherwise 
- */
-int of_rdlock(int fhandle) {
-    if (!valid_file_handle(fhandle)) {
-        return -1;
-    }
-
-    if (pthread_rwlock_rdlock(&open_file_table[fhandle].of_lock) != 0) {
-        return -1;
-    }
-
-    return 0;
-}
-
-/* Applies a write-lock to the file's rwlock
- * Returns: 0 if successful -1 otherwise 
- */
-int of_wrlock(int fhandle) {
-    if (!valid_file_handle(fhandle)) {
-        return -1;
-    }
-
-    if (pthread_rwlock_wrlock(&open_file_table[fhandle].of_lock) != 0) {
-        return -1;
-    }
-
-    return 0;
-}
-
-/* Unlocks the file's rwlock
- * Returns: 0 if successful -1 otherwise 
- */
-int of_unlock(int fhandle) {
-    if (!valid_file_handle(fhandle)) {
-        return -1;
-    }
-
-    if (pthread_rwlock_unlock(&open_file_table[fhandle].of_lock) != 0) {
-        return -1;
-    }
-
-    return 0;
-}
+#include "state.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+
+/* Persistent FS state (in reality, it should be maintained in secondary
+ * memory; for simplicity, this project maintains it in primary memory) */
+
+/* Geometry currently in effect: the config.h macros are only the
+ * defaults, state_init_with_params() may pick different sizes and the
+ * tables below are heap-allocated accordingly */
+size_t fs_block_size = BLOCK_SIZE;
+size_t fs_data_blocks = DATA_BLOCKS;
+int fs_inode_table_size = INODE_TABLE_SIZE;
+int fs_max_open_files = MAX_OPEN_FILES;
+
+/* I-node table */
+static inode_t *inode_table;
+static char *freeinode_ts;
+
+/* The i-nodes' locks, kept apart from the table in a parallel array:
+ * each lock sits alone in a cache-line-sized slot, so threads hammering
+ * the locks of adjacent i-nodes never false-share a line, neither with
+ * each other nor with the read-mostly metadata in inode_table (this
+ * also keeps the locks out of the persistent store when the table is
+ * mmap-backed). Every lock is initialized up front in state_init, so
+ * creating or recovering an i-node costs no lock setup */
+#define CACHE_LINE_SIZE (64)
+
+typedef union {
+    pthread_rwlock_t pl_lock;
+    char pl_padding[((sizeof(pthread_rwlock_t) + CACHE_LINE_SIZE - 1) /
+                     CACHE_LINE_SIZE) *
+                    CACHE_LINE_SIZE];
+} padded_rwlock_t;
+
+static padded_rwlock_t *inode_locks;
+
+/* The i-node table is split into INODE_TABLE_SHARDS contiguous regions
+ * ("shards"), each with its own free stack and rwlock, so inode_create /
+ * inode_delete calls from different threads only contend when they land
+ * on the same shard. Each shard owns INODE_SHARD_SPAN consecutive
+ * inumbers (the last one may own less) */
+#define INODE_SHARD_SPAN ((fs_inode_table_size + INODE_TABLE_SHARDS - 1) / INODE_TABLE_SHARDS)
+
+static int *free_inode_stacks[INODE_TABLE_SHARDS];
+static int free_inode_sps[INODE_TABLE_SHARDS];
+/* rwlocks used for protecting each of the i-node table's shards */
+static pthread_rwlock_t i_shard_rwlocks[INODE_TABLE_SHARDS];
+/* Round-robin hint for picking the shard the next inode_create starts
+ * its search on. Starts at 0 so the very first i-node ever created (the
+ * root directory) deterministically gets inumber ROOT_DIR_INUM */
+static _Atomic unsigned i_shard_hint;
+
+
+/* Data blocks */
+static char *fs_data;
+static char *free_blocks;
+
+/* When a backing file is used, the persistent tables (freeinode_ts,
+ * free_blocks, inode_table and fs_data) live inside one mmap'd file
+ * instead of the heap, laid out after a small header that pins down the
+ * geometry the store was created with. store_map is NULL in the purely
+ * in-memory mode */
+typedef struct {
+    uint64_t s_magic;
+    uint64_t s_block_size;
+    uint64_t s_data_blocks;
+    uint64_t s_inode_table_size;
+} store_header_t;
+
+#define STORE_MAGIC (0x54656353746f7265ULL) /* "TecStore" */
+
+static int store_fd = -1;
+static char *store_map;
+static size_t store_size;
+
+/* Write-back flusher: a per-block dirty map filled by the write paths
+ * and drained by a background thread, which msyncs the dirty blocks in
+ * batched sequential ranges so write bursts are absorbed in RAM instead
+ * of paying synchronous writeout. Only runs when a store is mapped and
+ * the caller asked for it (flush_interval_ms != 0) */
+static _Atomic unsigned char *block_dirty;
+static size_t fs_flush_interval_ms;
+static pthread_t flusher_thread;
+static bool flusher_running;
+static bool flusher_stop;
+static pthread_mutex_t flusher_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusher_cond = PTHREAD_COND_INITIALIZER;
+/* Stack of free block indexes, so allocation pops in O(1) instead of
+ * scanning the whole free_blocks array (free_blocks is kept as the
+ * "persistent" allocation map, the stack is just its in-memory index) */
+static int *free_block_stack;
+static int free_block_sp;
+/* How many i-node mappings reference each block (clones share data
+ * blocks, so a block only goes back to the pool when the last reference
+ * drops). Updated under data_block_rwlock */
+static int *block_refcnt;
+/* rwlock used for protecting the data block table */
+static pthread_rwlock_t data_block_rwlock;
+
+
+/* In-memory hash index over directory entries (name -> d_inumber), kept
+ * alongside the block-resident dir_entry_t array so lookups don't have to
+ * scan the whole directory block. It is volatile state: it only mirrors
+ * what add_dir_entry wrote to the block, and is reset whenever a new
+ * directory i-node is created. Collisions are handled with linear
+ * probing, and a bucket with d_inumber == -1 means "empty" (just like in
+ * the directory block itself). The bucket count follows the runtime
+ * geometry (set by state_init_with_params): at least twice the entries a
+ * directory block holds, so the index can never fill up before the block
+ * does */
+static size_t dir_index_buckets;
+
+typedef struct {
+    char d_name[MAX_FILE_NAME];
+    int d_inumber;
+} dir_index_entry_t;
+
+static dir_index_entry_t *dir_index;
+
+static void dir_index_clear(int inumber);
+static int dir_index_insert(int inumber, int sub_inumber, char const *sub_name);
+static int dir_index_rebuild(int inumber);
+static int inode_count_block_refs(int inumber);
+static int state_recover();
+
+
+/* Volatile FS state */
+
+static open_file_entry_t *open_file_table;
+static char *free_open_file_entries;
+
+/* The open file table is striped the same way as the i-node table: each
+ * shard owns OF_SHARD_SPAN consecutive handles with its own free stack
+ * and rwlock, so open/close calls from different threads only contend
+ * when they land on the same shard */
+#define OF_SHARD_SPAN ((fs_max_open_files + OPEN_FILE_SHARDS - 1) / OPEN_FILE_SHARDS)
+
+static int *free_of_stacks[OPEN_FILE_SHARDS];
+static int free_of_sps[OPEN_FILE_SHARDS];
+/* rwlocks used for protecting each of the open file table's shards */
+static pthread_rwlock_t of_shard_rwlocks[OPEN_FILE_SHARDS];
+/* Round-robin hint for picking the shard the next open starts its
+ * search on */
+static _Atomic unsigned of_shard_hint;
+
+ 
+static inline bool valid_inumber(int inumber) {
+    return inumber >= 0 && inumber < fs_inode_table_size;
+}
+
+static inline bool valid_block_number(int block_number) {
+    return block_number >= 0 && (size_t)block_number < fs_data_blocks;
+}
+
+static inline bool valid_file_handle(int file_handle) {
+    return file_handle >= 0 && file_handle < fs_max_open_files;
+}
+
+/**
+ * We need to defeat the optimizer for the insert_delay() function.
+ * Under optimization, the empty loop would be completely optimized away.
+ * This function tells the compiler that the assembly code being run (which is
+ * none) might potentially change *all memory in the process*.
+ *
+ * This prevents the optimizer from optimizing this code away, because it does
+ * not know what it does and it may have side effects.
+ *
+ * Reference with more information: https://youtu.be/nXaxk27zwlk?t=2775
+ *
+ * Exercise: try removing this function and look at the assembly generated to
+ * compare.
+ */
+static void touch_all_memory() { __asm volatile("" : : : "memory"); }
+
+/*
+ * Auxiliary function to insert a delay.
+ * Used in accesses to persistent FS state as a way of emulating access
+ * latencies as if such data structures were really stored in secondary memory.
+ */
+/* The selected storage backend; only TFS_BACKEND_EMULATED pays the
+ * artificial delay below */
+static tfs_backend_t fs_backend = TFS_BACKEND_EMULATED;
+
+static void insert_delay() {
+    if (fs_backend != TFS_BACKEND_EMULATED) {
+        return;
+    }
+
+    for (int i = 0; i < DELAY; i++) {
+        touch_all_memory();
+    }
+}
+
+/* Every thread that touches the filesystem gets its own statistics
+ * block the first time it does, pushed onto this list with a lock-free
+ * compare-and-swap. The blocks are never freed (each thread keeps a
+ * thread-local pointer to its block, which must stay valid even across
+ * re-initialization), so bumping a counter on the hot path is a plain
+ * unsynchronized increment; state_stats_aggregate() walks the list */
+static _Atomic(thread_stats_t *) all_thread_stats;
+
+static _Thread_local thread_stats_t *my_thread_stats;
+
+/* Shared by every thread whose block couldn't be allocated: the
+ * counters then race, but only while the process is out of memory */
+static thread_stats_t thread_stats_fallback;
+
+thread_stats_t *state_thread_stats() {
+    if (my_thread_stats == NULL) {
+        thread_stats_t *block = calloc(1, sizeof(thread_stats_t));
+        if (block == NULL) {
+            return &thread_stats_fallback;
+        }
+
+        block->next = atomic_load(&all_thread_stats);
+        while (!atomic_compare_exchange_weak(&all_thread_stats, &block->next,
+                                             block)) {
+        }
+        my_thread_stats = block;
+    }
+
+    return my_thread_stats;
+}
+
+/* Zeroes every thread's counters, so the statistics restart together
+ * with the filesystem (the blocks themselves stay on the list: their
+ * owners' thread-local pointers must remain valid) */
+static void state_stats_reset() {
+    for (thread_stats_t *block = atomic_load(&all_thread_stats);
+         block != NULL; block = block->next) {
+        thread_stats_t *next = block->next;
+        memset(block, 0, sizeof(thread_stats_t));
+        block->next = next;
+    }
+    memset(&thread_stats_fallback, 0, sizeof(thread_stats_t));
+}
+
+/* Locks one of the state's rwlocks, charging any time spent blocked to
+ * the calling thread's statistics. The uncontended path costs a single
+ * trylock: the clock is only read when the lock is actually fought over
+ */
+static int stat_rwlock_rdlock(pthread_rwlock_t *rwlock,
+                              stat_lock_family_t family) {
+    if (pthread_rwlock_tryrdlock(rwlock) == 0) {
+        return 0;
+    }
+
+    struct timespec t0;
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (pthread_rwlock_rdlock(rwlock) != 0) {
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    state_thread_stats()->lock_wait_ns[family] +=
+        (size_t)((t1.tv_sec - t0.tv_sec) * 1000000000L +
+                 (t1.tv_nsec - t0.tv_nsec));
+    return 0;
+}
+
+/* Same as above, for the write side */
+static int stat_rwlock_wrlock(pthread_rwlock_t *rwlock,
+                              stat_lock_family_t family) {
+    if (pthread_rwlock_trywrlock(rwlock) == 0) {
+        return 0;
+    }
+
+    struct timespec t0;
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (pthread_rwlock_wrlock(rwlock) != 0) {
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    state_thread_stats()->lock_wait_ns[family] +=
+        (size_t)((t1.tv_sec - t0.tv_sec) * 1000000000L +
+                 (t1.tv_nsec - t0.tv_nsec));
+    return 0;
+}
+
+/* Sums every thread's counters and snapshots the allocators' occupancy
+ * (the free maps are read without their locks: a reading that is one
+ * allocation off is fine for monitoring) */
+void state_stats_aggregate(tfs_stats *stats) {
+    memset(stats, 0, sizeof(tfs_stats));
+
+    thread_stats_t const *fallback = &thread_stats_fallback;
+    for (thread_stats_t const *block = atomic_load(&all_thread_stats);;
+         block = block->next) {
+        if (block == NULL) {
+            /* The fallback block is not on the list; its counters join
+             * the totals last */
+            block = fallback;
+            fallback = NULL;
+        }
+
+        stats->open_calls += block->open_calls;
+        stats->close_calls += block->close_calls;
+        stats->read_calls += block->read_calls;
+        stats->write_calls += block->write_calls;
+        stats->bytes_read += block->bytes_read;
+        stats->bytes_written += block->bytes_written;
+
+        stats->lock_wait_inode_table_ns +=
+            block->lock_wait_ns[STAT_LOCK_INODE_TABLE];
+        stats->lock_wait_data_blocks_ns +=
+            block->lock_wait_ns[STAT_LOCK_DATA_BLOCKS];
+        stats->lock_wait_open_files_ns +=
+            block->lock_wait_ns[STAT_LOCK_OPEN_FILES];
+        stats->lock_wait_inodes_ns += block->lock_wait_ns[STAT_LOCK_INODES];
+
+        if (fallback == NULL) {
+            break;
+        }
+    }
+
+    if (inode_table == NULL) {
+        /* Not initialized: there is no occupancy to report */
+        return;
+    }
+
+    stats->inodes_total = (size_t)fs_inode_table_size;
+    for (int i = 0; i < fs_inode_table_size; i++) {
+        if (freeinode_ts[i] == TAKEN) {
+            stats->inodes_used++;
+        }
+    }
+
+    stats->data_blocks_total = fs_data_blocks;
+    for (size_t i = 0; i < fs_data_blocks; i++) {
+        if (free_blocks[i] == TAKEN) {
+            stats->data_blocks_used++;
+        }
+    }
+
+    stats->open_files_total = (size_t)fs_max_open_files;
+    for (int i = 0; i < fs_max_open_files; i++) {
+        if (free_open_file_entries[i] == TAKEN) {
+            stats->open_files_used++;
+        }
+    }
+}
+
+/*
+ * One flusher pass: drains the dirty map, coalescing runs of consecutive
+ * dirty blocks into single msync calls (sequential writeout), and then
+ * pushes the metadata region, same data-before-metadata order as
+ * state_sync(). Concurrent writers re-dirty blocks safely: each flag is
+ * atomically taken before its block is flushed.
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int flusher_flush_pass() {
+    if (store_map == NULL || block_dirty == NULL) {
+        return 0;
+    }
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t data_off = (size_t)(fs_data - store_map);
+    int failed = 0;
+
+    size_t i = 0;
+    while (i < fs_data_blocks) {
+        if (atomic_exchange(&block_dirty[i], 0) == 0) {
+            i++;
+            continue;
+        }
+
+        size_t start = i++;
+        while (i < fs_data_blocks &&
+               atomic_exchange(&block_dirty[i], 0) != 0) {
+            i++;
+        }
+
+        size_t from = (data_off + start * fs_block_size) & ~(page - 1);
+        size_t to = data_off + i * fs_block_size;
+        if (msync(store_map + from, to - from, MS_SYNC) != 0) {
+            failed = 1;
+        }
+    }
+
+    /* The metadata region is small: push it wholesale */
+    size_t meta_end = data_off & ~(page - 1);
+    if (msync(store_map, meta_end == 0 ? store_size : meta_end,
+              MS_SYNC) != 0) {
+        failed = 1;
+    }
+
+    return failed ? -1 : 0;
+}
+
+static void *flusher_fn(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&flusher_mutex);
+    while (!flusher_stop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += (long)(fs_flush_interval_ms % 1000) * 1000000;
+        ts.tv_sec += (time_t)(fs_flush_interval_ms / 1000) +
+                     ts.tv_nsec / 1000000000;
+        ts.tv_nsec %= 1000000000;
+
+        pthread_cond_timedwait(&flusher_cond, &flusher_mutex, &ts);
+        if (flusher_stop) {
+            break;
+        }
+
+        pthread_mutex_unlock(&flusher_mutex);
+        flusher_flush_pass();
+        pthread_mutex_lock(&flusher_mutex);
+    }
+    pthread_mutex_unlock(&flusher_mutex);
+
+    return NULL;
+}
+
+/*
+ * Stops the background flusher (if one is running) after a final pass,
+ * so teardown never races the thread against the unmapping
+ */
+static void flusher_shutdown() {
+    if (flusher_running) {
+        pthread_mutex_lock(&flusher_mutex);
+        flusher_stop = true;
+        pthread_cond_signal(&flusher_cond);
+        pthread_mutex_unlock(&flusher_mutex);
+
+        pthread_join(flusher_thread, NULL);
+        flusher_running = false;
+        flusher_stop = false;
+
+        /* Whatever was dirtied since the last pass still goes out */
+        flusher_flush_pass();
+    }
+
+    free((void *)block_dirty);
+    block_dirty = NULL;
+}
+
+/*
+ * Frees every heap-allocated table, so the state can be torn down (or
+ * re-initialized with a different geometry)
+ */
+static void state_dealloc() {
+    flusher_shutdown();
+
+    if (store_map != NULL) {
+        /* The persistent tables live inside the mapping: unmapping
+         * releases them all at once */
+        munmap(store_map, store_size);
+        store_map = NULL;
+        store_size = 0;
+        close(store_fd);
+        store_fd = -1;
+
+        inode_table = NULL;
+        freeinode_ts = NULL;
+        fs_data = NULL;
+        free_blocks = NULL;
+    } else {
+        free(inode_table);
+        inode_table = NULL;
+        free(freeinode_ts);
+        freeinode_ts = NULL;
+        free(fs_data);
+        fs_data = NULL;
+        free(free_blocks);
+        free_blocks = NULL;
+    }
+
+    /* The volatile tables are always heap-allocated */
+    free(inode_locks);
+    inode_locks = NULL;
+    for (int s = 0; s < INODE_TABLE_SHARDS; s++) {
+        free(free_inode_stacks[s]);
+        free_inode_stacks[s] = NULL;
+    }
+    free(free_block_stack);
+    free_block_stack = NULL;
+    free(block_refcnt);
+    block_refcnt = NULL;
+
+    free(dir_index);
+    dir_index = NULL;
+
+    free(open_file_table);
+    open_file_table = NULL;
+    free(free_open_file_entries);
+    free_open_file_entries = NULL;
+    for (int s = 0; s < OPEN_FILE_SHARDS; s++) {
+        free(free_of_stacks[s]);
+        free_of_stacks[s] = NULL;
+    }
+}
+
+/* Rounds a store offset up so the table that starts there is aligned */
+static size_t store_align(size_t offset) {
+    return (offset + 63) & ~(size_t)63;
+}
+
+/*
+ * Maps the backing file and points the persistent tables into it. A file
+ * that doesn't exist yet (or is empty) is sized and stamped as a fresh
+ * store; an existing one must have been created with the same geometry.
+ * Inputs:
+ *  - backing_file: path of the store
+ *  - loaded: set to true when an existing store was loaded (so the
+ *    caller knows not to reset the free maps)
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int store_map_file(char const *backing_file, bool *loaded) {
+    /* Table offsets inside the file, each aligned */
+    size_t freeinode_off = store_align(sizeof(store_header_t));
+    size_t free_blocks_off =
+        store_align(freeinode_off + (size_t)fs_inode_table_size);
+    size_t inode_table_off =
+        store_align(free_blocks_off + fs_data_blocks);
+    size_t fs_data_off = store_align(
+        inode_table_off + (size_t)fs_inode_table_size * sizeof(inode_t));
+    size_t total = store_align(fs_data_off + fs_block_size * fs_data_blocks);
+
+    store_fd = open(backing_file, O_RDWR | O_CREAT, 0644);
+    if (store_fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(store_fd, &st) != 0) {
+        close(store_fd);
+        store_fd = -1;
+        return -1;
+    }
+
+    bool fresh = (st.st_size == 0);
+    if (fresh) {
+        if (ftruncate(store_fd, (off_t)total) != 0) {
+            close(store_fd);
+            store_fd = -1;
+            return -1;
+        }
+    } else if ((size_t)st.st_size != total) {
+        /* Created with a different geometry (or not a store at all) */
+        close(store_fd);
+        store_fd = -1;
+        return -1;
+    }
+
+    store_map = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     store_fd, 0);
+    if (store_map == MAP_FAILED) {
+        store_map = NULL;
+        close(store_fd);
+        store_fd = -1;
+        return -1;
+    }
+    store_size = total;
+
+    store_header_t *header = (store_header_t *)(void *)store_map;
+    if (fresh) {
+        header->s_magic = STORE_MAGIC;
+        header->s_block_size = fs_block_size;
+        header->s_data_blocks = fs_data_blocks;
+        header->s_inode_table_size = (uint64_t)fs_inode_table_size;
+    } else if (header->s_magic != STORE_MAGIC ||
+               header->s_block_size != fs_block_size ||
+               header->s_data_blocks != fs_data_blocks ||
+               header->s_inode_table_size != (uint64_t)fs_inode_table_size) {
+        state_dealloc();
+        return -1;
+    }
+
+    freeinode_ts = store_map + freeinode_off;
+    free_blocks = store_map + free_blocks_off;
+    inode_table = (inode_t *)(void *)(store_map + inode_table_off);
+    fs_data = store_map + fs_data_off;
+
+    *loaded = !fresh;
+    return 0;
+}
+
+/*
+ * Initializes FS state with the requested geometry, allocating every
+ * table accordingly. A NULL params keeps the config.h defaults.
+ * Returns: 0 if successful, -1 otherwise
+ */
+int state_init_with_params(tfs_params const *params) {
+    if (params != NULL) {
+        /* The geometry has to make minimal sense: a block must at least
+         * hold one directory entry, and the root directory needs an
+         * i-node, a data block and (for the callers) an open file slot */
+        if (params->block_size < sizeof(dir_entry_t) ||
+            params->data_blocks == 0 || params->inode_table_size <= 0 ||
+            params->max_open_files <= 0) {
+            return -1;
+        }
+
+        /* The mmap backend is the store: without a file to map there is
+         * nothing to back it with */
+        if (params->backend == TFS_BACKEND_MMAP &&
+            params->backing_file == NULL) {
+            return -1;
+        }
+
+        fs_block_size = params->block_size;
+        fs_data_blocks = params->data_blocks;
+        fs_inode_table_size = params->inode_table_size;
+        fs_max_open_files = params->max_open_files;
+        fs_backend = params->backend;
+        fs_flush_interval_ms = params->flush_interval_ms;
+    } else {
+        fs_backend = TFS_BACKEND_EMULATED;
+        fs_flush_interval_ms = 0;
+    }
+
+    /* In case the state was already initialized, the old tables go away
+     * first */
+    state_dealloc();
+
+    /* The statistics restart together with the filesystem */
+    state_stats_reset();
+
+    /* With a backing file the persistent tables come from the mapping,
+     * otherwise from the heap as before */
+    bool loaded = false;
+    if (params != NULL && params->backing_file != NULL) {
+        if (store_map_file(params->backing_file, &loaded) != 0) {
+            return -1;
+        }
+    } else {
+        inode_table = malloc((size_t)fs_inode_table_size * sizeof(inode_t));
+        freeinode_ts = malloc((size_t)fs_inode_table_size);
+        fs_data = malloc(fs_block_size * fs_data_blocks);
+        free_blocks = malloc(fs_data_blocks);
+    }
+
+    /* The lock array is aligned to the cache line so no slot ever
+     * straddles two lines (aligned_alloc wants the size to be a multiple
+     * of the alignment, which sizeof(padded_rwlock_t) guarantees) */
+    inode_locks =
+        aligned_alloc(CACHE_LINE_SIZE,
+                      (size_t)fs_inode_table_size * sizeof(padded_rwlock_t));
+
+    for (int s = 0; s < INODE_TABLE_SHARDS; s++) {
+        free_inode_stacks[s] = malloc((size_t)INODE_SHARD_SPAN * sizeof(int));
+    }
+
+    free_block_stack = malloc(fs_data_blocks * sizeof(int));
+    block_refcnt = calloc(fs_data_blocks, sizeof(int));
+
+    /* Twice what a directory block holds, rounded up to a power of two
+     * to keep the probe chains short at any block size */
+    dir_index_buckets = 1;
+    while (dir_index_buckets < 2 * MAX_DIR_ENTRIES) {
+        dir_index_buckets *= 2;
+    }
+    dir_index = malloc((size_t)fs_inode_table_size * dir_index_buckets *
+                       sizeof(dir_index_entry_t));
+
+    open_file_table = malloc((size_t)fs_max_open_files *
+                             sizeof(open_file_entry_t));
+    free_open_file_entries = malloc((size_t)fs_max_open_files);
+    for (int s = 0; s < OPEN_FILE_SHARDS; s++) {
+        free_of_stacks[s] = malloc((size_t)OF_SHARD_SPAN * sizeof(int));
+    }
+
+    if (inode_table == NULL || inode_locks == NULL || freeinode_ts == NULL ||
+        fs_data == NULL || free_blocks == NULL || free_block_stack == NULL ||
+        block_refcnt == NULL || dir_index == NULL ||
+        open_file_table == NULL || free_open_file_entries == NULL) {
+        printf("state_init(): table allocation failed\n");
+        state_dealloc();
+        return -1;
+    }
+    for (int s = 0; s < INODE_TABLE_SHARDS; s++) {
+        if (free_inode_stacks[s] == NULL) {
+            printf("state_init(): table allocation failed\n");
+            state_dealloc();
+            return -1;
+        }
+    }
+    for (int s = 0; s < OPEN_FILE_SHARDS; s++) {
+        if (free_of_stacks[s] == NULL) {
+            printf("state_init(): table allocation failed\n");
+            state_dealloc();
+            return -1;
+        }
+    }
+
+    for (int s = 0; s < INODE_TABLE_SHARDS; s++) {
+        free_inode_sps[s] = 0;
+    }
+    i_shard_hint = 0;
+    if (!loaded) {
+        /* A fresh filesystem starts with everything free; a loaded store
+         * keeps its allocation maps as they were */
+        for (int i = 0; i < fs_inode_table_size; i++) {
+            freeinode_ts[i] = FREE;
+        }
+        for (size_t i = 0; i < fs_data_blocks; i++) {
+            free_blocks[i] = FREE;
+        }
+    }
+
+    /* Fills each shard's free stack with the inumbers its allocation map
+     * marks as free, in reverse order so the lowest inumber sits on top
+     * (same trick as the data block stack below) */
+    for (int i = fs_inode_table_size - 1; i >= 0; i--) {
+        int s = i / INODE_SHARD_SPAN;
+
+        if (freeinode_ts[i] == FREE) {
+            free_inode_stacks[s][free_inode_sps[s]++] = i;
+        }
+    }
+
+    /* Pushes the blocks in reverse order so the lowest index sits on top
+     * of the stack, keeping the same allocation order as the old scan */
+    free_block_sp = 0;
+    for (int i = (int)fs_data_blocks - 1; i >= 0; i--) {
+        if (free_blocks[i] == FREE) {
+            free_block_stack[free_block_sp++] = i;
+        }
+    }
+
+    /* Fills each open file shard's free stack, lowest handle on top */
+    for (int s = 0; s < OPEN_FILE_SHARDS; s++) {
+        free_of_sps[s] = 0;
+    }
+    of_shard_hint = 0;
+    for (int i = fs_max_open_files - 1; i >= 0; i--) {
+        int s = i / OF_SHARD_SPAN;
+
+        free_open_file_entries[i] = FREE;
+        free_of_stacks[s][free_of_sps[s]++] = i;
+    }
+
+    /* Initializes the i-node table's shard rwlocks for later use */
+    for (int s = 0; s < INODE_TABLE_SHARDS; s++) {
+        if (pthread_rwlock_init(&i_shard_rwlocks[s], NULL) != 0) {
+            printf("state_init(): i-node table lock initialization failed\n");
+            return -1;
+        }
+    }
+
+    /* Initializes every i-node's lock up front: the locks are volatile
+     * state living outside the table, so neither inode_create nor
+     * state_recover has to set them up per i-node anymore */
+    for (int i = 0; i < fs_inode_table_size; i++) {
+        if (pthread_rwlock_init(&inode_locks[i].pl_lock, NULL) != 0) {
+            printf("state_init(): i-node lock initialization failed\n");
+            return -1;
+        }
+    }
+
+    /* Initializes the data block table rwlock for later use */
+    if (pthread_rwlock_init(&data_block_rwlock, NULL) != 0) { 
+        printf("state_init(): data block table lock initialization failed\n");
+        return -1;
+    }
+
+    /* Initializes the open file table's shard rwlocks for later use */
+    for (int s = 0; s < OPEN_FILE_SHARDS; s++) {
+        if (pthread_rwlock_init(&of_shard_rwlocks[s], NULL) != 0) {
+            printf("state_init(): open file table lock initialization failed\n");
+            return -1;
+        }
+    }
+
+    if (loaded && state_recover() != 0) {
+        return -1;
+    }
+
+    /* With a mapped store and an interval, the write-back flusher takes
+     * over pushing dirty blocks out; without it, tfs_sync() remains the
+     * only writeout point */
+    if (store_map != NULL && fs_flush_interval_ms > 0) {
+        block_dirty = calloc(fs_data_blocks, sizeof(unsigned char));
+        if (block_dirty == NULL) {
+            return -1;
+        }
+
+        if (pthread_create(&flusher_thread, NULL, flusher_fn, NULL) != 0) {
+            return -1;
+        }
+        flusher_running = true;
+    }
+
+    return loaded ? 1 : 0;
+}
+
+/*
+ * Initializes FS state with the default geometry from config.h
+ * Returns: 0 if successful, -1 otherwise
+ */
+int state_init() { return state_init_with_params(NULL); }
+
+/*
+ * Adds an i-node's contribution to the block reference counts, walking
+ * its direct, indirect and double indirect mappings (the reference
+ * blocks themselves count too, since freeing the i-node frees them).
+ * Only used while rebuilding state from disk, so no locking is needed.
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int inode_count_block_refs(int inumber) {
+    inode_t *inode = &inode_table[inumber];
+
+    for (size_t i = 0; i < MAX_FILE_BLOCKS; i++) {
+        if (inode->i_data_blocks[i] != -1) {
+            block_refcnt[inode->i_data_blocks[i]]++;
+        }
+    }
+
+    if (inode->i_indir_block != -1) {
+        block_refcnt[inode->i_indir_block]++;
+
+        int *block = (int *)data_block_get(inode->i_indir_block);
+        if (block == NULL) {
+            return -1;
+        }
+
+        for (size_t i = 0; i < INDIR_BLOCK_SIZE; i++) {
+            if (block[i] != -1) {
+                block_refcnt[block[i]]++;
+            }
+        }
+    }
+
+    if (inode->i_dindir_block != -1) {
+        block_refcnt[inode->i_dindir_block]++;
+
+        int *outer = (int *)data_block_get(inode->i_dindir_block);
+        if (outer == NULL) {
+            return -1;
+        }
+
+        for (size_t i = 0; i < INDIR_BLOCK_SIZE; i++) {
+            if (outer[i] == -1) {
+                continue;
+            }
+            block_refcnt[outer[i]]++;
+
+            int *inner = (int *)data_block_get(outer[i]);
+            if (inner == NULL) {
+                return -1;
+            }
+
+            for (size_t j = 0; j < INDIR_BLOCK_SIZE; j++) {
+                if (inner[j] != -1) {
+                    block_refcnt[inner[j]]++;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Reconstructs the volatile side of i-nodes that came in from disk (a
+ * loaded store or an imported image): the block reference counts and the
+ * in-memory directory indexes are rebuilt from the tables (the i-node
+ * locks need no recovery: they live outside the store and were all
+ * initialized in state_init).
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int state_recover() {
+    /* The reference counts are volatile too: recount them from scratch
+     * by walking every live i-node's block mapping (blocks shared by
+     * clones simply get counted more than once) */
+    memset(block_refcnt, 0, fs_data_blocks * sizeof(int));
+
+    for (int i = 0; i < fs_inode_table_size; i++) {
+        if (freeinode_ts[i] != TAKEN) {
+            continue;
+        }
+
+        if (inode_count_block_refs(i) != 0) {
+            printf("state_recover(): block reference recount failed\n");
+            return -1;
+        }
+
+        if (inode_table[i].i_node_type == T_DIRECTORY &&
+            dir_index_rebuild(i) != 0) {
+            printf("state_recover(): directory index rebuild failed\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Flushes the persistent state to the backing file, data blocks first
+ * and the metadata (i-node table and free maps) only after, so a crash
+ * between the two can at worst leak blocks, never leave metadata
+ * pointing at contents that were not written out. A no-op in the purely
+ * in-memory mode.
+ * Returns: 0 if successful, -1 otherwise
+ */
+int state_sync() {
+    if (store_map == NULL) {
+        return 0;
+    }
+
+    /* msync needs page-aligned addresses: the data region's start is
+     * rounded down (at worst re-flushing a page of metadata early, which
+     * doesn't break the ordering for the rest of it) */
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t data_off = ((size_t)(fs_data - store_map)) & ~(page - 1);
+
+    if (msync(store_map + data_off, store_size - data_off, MS_SYNC) != 0) {
+        return -1;
+    }
+
+    if (msync(store_map, data_off == 0 ? store_size : data_off,
+              MS_SYNC) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Serializes the whole filesystem image (header, free maps, i-node table
+ * and data blocks) to a file in one sequential pass. The caller must
+ * make sure no operations run concurrently, or the image may mix states.
+ * Input:
+ *  - path: where to write the image (overwritten if it exists)
+ * Returns: 0 if successful, -1 otherwise
+ */
+int state_export(char const *path) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    store_header_t header = {
+        .s_magic = STORE_MAGIC,
+        .s_block_size = fs_block_size,
+        .s_data_blocks = fs_data_blocks,
+        .s_inode_table_size = (uint64_t)fs_inode_table_size,
+    };
+
+    if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+        fwrite(freeinode_ts, 1, (size_t)fs_inode_table_size, fp) !=
+            (size_t)fs_inode_table_size ||
+        fwrite(free_blocks, 1, fs_data_blocks, fp) != fs_data_blocks ||
+        fwrite(inode_table, sizeof(inode_t), (size_t)fs_inode_table_size,
+               fp) != (size_t)fs_inode_table_size ||
+        fwrite(fs_data, fs_block_size, fs_data_blocks, fp) !=
+            fs_data_blocks) {
+        fclose(fp);
+        return -1;
+    }
+
+    if (fclose(fp) == EOF) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Restores the filesystem from an image previously written by
+ * state_export: the state is re-initialized with the image's geometry,
+ * the tables are read back in one sequential pass and the volatile state
+ * is reconstructed. Whatever the filesystem held before the call is
+ * discarded.
+ * Input:
+ *  - path: image to read
+ * Returns: 0 if successful, -1 otherwise
+ */
+int state_import(char const *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    store_header_t header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.s_magic != STORE_MAGIC) {
+        fclose(fp);
+        return -1;
+    }
+
+    /* Brings up a fresh filesystem with the image's geometry (in-memory:
+     * an image import doesn't attach a backing file). The backend is
+     * kept, like max_open_files, since it isn't part of the image; only
+     * mmap can't survive without its backing file and becomes RAM */
+    tfs_params params = {
+        .block_size = header.s_block_size,
+        .data_blocks = header.s_data_blocks,
+        .inode_table_size = (int)header.s_inode_table_size,
+        .max_open_files = fs_max_open_files,
+        .backing_file = NULL,
+        .backend = (fs_backend == TFS_BACKEND_MMAP) ? TFS_BACKEND_RAM
+                                                    : fs_backend,
+    };
+    if (state_init_with_params(&params) != 0) {
+        fclose(fp);
+        return -1;
+    }
+
+    if (fread(freeinode_ts, 1, (size_t)fs_inode_table_size, fp) !=
+            (size_t)fs_inode_table_size ||
+        fread(free_blocks, 1, fs_data_blocks, fp) != fs_data_blocks ||
+        fread(inode_table, sizeof(inode_t), (size_t)fs_inode_table_size,
+              fp) != (size_t)fs_inode_table_size ||
+        fread(fs_data, fs_block_size, fs_data_blocks, fp) !=
+            fs_data_blocks) {
+        fclose(fp);
+        return -1;
+    }
+
+    if (fclose(fp) == EOF) {
+        return -1;
+    }
+
+    /* The free stacks were built for an empty filesystem: rebuild them
+     * (and the rest of the volatile state) for what the image brought */
+    for (int st = 0; st < INODE_TABLE_SHARDS; st++) {
+        free_inode_sps[st] = 0;
+    }
+    for (int i = fs_inode_table_size - 1; i >= 0; i--) {
+        if (freeinode_ts[i] == FREE) {
+            free_inode_stacks[i / INODE_SHARD_SPAN][
+                free_inode_sps[i / INODE_SHARD_SPAN]++] = i;
+        }
+    }
+    free_block_sp = 0;
+    for (int i = (int)fs_data_blocks - 1; i >= 0; i--) {
+        if (free_blocks[i] == FREE) {
+            free_block_stack[free_block_sp++] = i;
+        }
+    }
+
+    return state_recover();
+}
+
+void state_destroy() {
+    /* Destroys all the i-node's locks (every slot holds an initialized
+     * lock, taken or not) */
+    for (int inumber = 0; inumber < fs_inode_table_size; inumber++) {
+        if (pthread_rwlock_destroy(&inode_locks[inumber].pl_lock) != 0) {
+            printf("state_destroy(): inode lock destruction failed\n");
+            return;
+        }
+    }
+
+    /* Destroys all the open file's locks */
+    for (int fhandle = 0; fhandle < fs_max_open_files; fhandle++) {
+        if (free_open_file_entries[fhandle] == TAKEN) {
+            if (pthread_rwlock_destroy(&open_file_table[fhandle].of_lock) != 0) {
+                printf("state_destroy(): open file lock destruction failed\n");
+                return;
+            }
+        }
+    }
+
+    /* Destroys the table's locks */
+
+    for (int s = 0; s < INODE_TABLE_SHARDS; s++) {
+        if (pthread_rwlock_destroy(&i_shard_rwlocks[s]) != 0) {
+            printf("state_destroy(): i-node table lock destruction failed\n");
+            return;
+        }
+    }
+
+    if (pthread_rwlock_destroy(&data_block_rwlock) != 0) {
+        printf("state_destroy(): data block table lock destruction failed\n");
+        return;
+    }
+
+    for (int s = 0; s < OPEN_FILE_SHARDS; s++) {
+        if (pthread_rwlock_destroy(&of_shard_rwlocks[s]) != 0) {
+            printf("state_destroy(): open file table lock destruction failed\n");
+            return;
+        }
+    }
+
+    /* Finally, gives the tables themselves back */
+    state_dealloc();
+}
+
+/*
+ * Hashes a directory entry name into a bucket of a directory's index
+ * (djb2, which spreads our short names well enough for this few buckets)
+ */
+static size_t dir_index_hash(char const *name) {
+    size_t h = 5381;
+
+    for (char const *p = name; *p != '\0'; p++) {
+        h = h * 33 + (size_t)(unsigned char)*p;
+    }
+
+    return h % dir_index_buckets;
+}
+
+/*
+ * Empties a directory's hash index (every bucket marked with -1).
+ * Called when a directory i-node is created.
+ * Input:
+ *  - inumber: the directory's i-node number
+ */
+static void dir_index_clear(int inumber) {
+    for (size_t i = 0; i < dir_index_buckets; i++) {
+        dir_index[(size_t)inumber * dir_index_buckets + i].d_inumber = -1;
+    }
+}
+
+/*
+ * Looks a name up in a directory's hash index.
+ * Must be called with the directory's i-node locked.
+ * Inputs:
+ *  - inumber: the directory's i-node number
+ *  - sub_name: name to search
+ * Returns: the i-number linked to the name, -1 if not present
+ */
+static int dir_index_lookup(int inumber, char const *sub_name) {
+    size_t b = dir_index_hash(sub_name);
+
+    /* Probes from the name's bucket until an empty one is found; since
+     * entries are never moved, an empty bucket means the name was never
+     * inserted */
+    for (size_t i = 0; i < dir_index_buckets; i++) {
+        dir_index_entry_t *entry =
+            &dir_index[(size_t)inumber * dir_index_buckets +
+                       (b + i) % dir_index_buckets];
+
+        if (entry->d_inumber == -1) {
+            return -1;
+        }
+
+        if (strncmp(entry->d_name, sub_name, MAX_FILE_NAME) == 0) {
+            return entry->d_inumber;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Inserts a name -> d_inumber mapping in a directory's hash index.
+ * Must be called with the directory's i-node write locked.
+ * Inputs:
+ *  - inumber: the directory's i-node number
+ *  - sub_inumber: i-number the name maps to
+ *  - sub_name: name of the entry
+ * Returns: 0 if successful, -1 if the index is full
+ */
+static int dir_index_insert(int inumber, int sub_inumber, char const *sub_name) {
+    size_t b = dir_index_hash(sub_name);
+
+    for (size_t i = 0; i < dir_index_buckets; i++) {
+        dir_index_entry_t *entry =
+            &dir_index[(size_t)inumber * dir_index_buckets +
+                       (b + i) % dir_index_buckets];
+
+        if (entry->d_inumber == -1) {
+            strncpy(entry->d_name, sub_name, MAX_FILE_NAME - 1);
+            entry->d_name[MAX_FILE_NAME - 1] = 0;
+            entry->d_inumber = sub_inumber;
+
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Rebuilds a directory's hash index from its (persistent) block of
+ * directory entries, after a store was loaded from disk.
+ * Input:
+ *  - inumber: the directory's i-node number
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int dir_index_rebuild(int inumber) {
+    dir_index_clear(inumber);
+
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(inode_table[inumber].i_data_blocks[0]);
+    if (dir_entry == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if (dir_entry[i].d_inumber != -1 &&
+            dir_index_insert(inumber, dir_entry[i].d_inumber,
+                             dir_entry[i].d_name) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Takes a free inumber from one of the i-node table's shards.
+ * The starting shard rotates between calls, so concurrent creators
+ * naturally spread over different shards; if the chosen shard has no
+ * free slot the remaining ones are tried in order.
+ * Returns: inumber if successfully taken, -1 otherwise
+ */
+static int inode_slot_alloc() {
+    int start = (int)(atomic_fetch_add(&i_shard_hint, 1) % INODE_TABLE_SHARDS);
+
+    for (int i = 0; i < INODE_TABLE_SHARDS; i++) {
+        int s = (start + i) % INODE_TABLE_SHARDS;
+
+        if (stat_rwlock_wrlock(&i_shard_rwlocks[s], STAT_LOCK_INODE_TABLE) != 0) {
+            return -1;
+        }
+
+        insert_delay(); // simulate storage access delay (to freeinode_ts)
+
+        if (free_inode_sps[s] > 0) {
+            int inumber = free_inode_stacks[s][--free_inode_sps[s]];
+            freeinode_ts[inumber] = TAKEN;
+
+            if (pthread_rwlock_unlock(&i_shard_rwlocks[s]) != 0) {
+                return -1;
+            }
+
+            return inumber;
+        }
+
+        if (pthread_rwlock_unlock(&i_shard_rwlocks[s]) != 0) {
+            return -1;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Gives an inumber back to the shard that owns it.
+ * Input:
+ *  - inumber: i-node's number
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int inode_slot_free(int inumber) {
+    int s = inumber / INODE_SHARD_SPAN;
+
+    if (stat_rwlock_wrlock(&i_shard_rwlocks[s], STAT_LOCK_INODE_TABLE) != 0) {
+        return -1;
+    }
+
+    /* Only pushes the inumber back on the shard's free stack if it was
+     * actually taken, otherwise a double free would insert it twice */
+    if (freeinode_ts[inumber] == TAKEN) {
+        freeinode_ts[inumber] = FREE;
+        free_inode_stacks[s][free_inode_sps[s]++] = inumber;
+    }
+
+    if (pthread_rwlock_unlock(&i_shard_rwlocks[s]) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Creates a new i-node in the i-node table.
+ * Input:
+ *  - n_type: the type of the node (file or directory)
+ * Returns:
+ *  new i-node's number if successfully created, -1 otherwise
+ */
+int inode_create(inode_type n_type) {
+    /* Takes a free slot from one of the table's shards. Note that the
+     * i-node itself is initialized without holding any shard lock, since
+     * the slot is already ours */
+    int inumber = inode_slot_alloc();
+    if (inumber == -1) {
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay (to i-node)
+
+    if (n_type == T_DIRECTORY) {
+        /* Initializes directory (filling its block with empty
+         * entries, labeled with inumber == -1) */
+        int b = data_block_alloc();
+        if (b == -1) {
+            inode_slot_free(inumber);
+            return -1;
+        }
+
+        /* Apply a write lock to the i-node to protect it while its being
+         * initialized */
+        if (inode_wrlock(inumber) == -1) {
+            return -1;
+        }
+
+        inode_table[inumber].i_node_type = n_type;
+
+        inode_table[inumber].i_size = fs_block_size;
+
+        /* Since the i-node is a directory we only use one of the data blocks,
+         * the first one. */
+        inode_table[inumber].i_data_blocks[0] = b;
+        inode_table[inumber].i_curr_block = 0;
+
+        /* The remaining data blocks are initialized with -1, since they won't
+         * be used */
+        for (size_t i = 1; i < MAX_FILE_BLOCKS; i++) {
+            inode_table[inumber].i_data_blocks[i] = -1;
+        }
+        /* Likewise, the indirect blocks are also set to -1, as they won't be used */
+        inode_table[inumber].i_indir_block = -1;
+        inode_table[inumber].i_curr_indir = -1;
+        inode_table[inumber].i_dindir_block = -1;
+        inode_table[inumber].i_wgen = 0;
+
+        dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(b);
+        if (dir_entry == NULL) {
+            inode_slot_free(inumber);
+            inode_unlock(inumber);
+
+            return -1;
+        }
+
+        for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+            dir_entry[i].d_inumber = -1;
+        }
+
+        /* The new directory starts with an empty hash index */
+        dir_index_clear(inumber);
+
+        if (inode_unlock(inumber) == -1) {
+            return -1;
+        }
+    } else {
+        /* Apply a write lock to the i-node to protect it while its being
+         * initialized */
+        if (inode_wrlock(inumber) == -1) {
+            return -1;
+        }
+
+        inode_table[inumber].i_node_type = n_type;
+
+        /* In case of a new file, simply sets its size to 0 */
+        inode_table[inumber].i_size = 0;
+
+        /* We initialize every data block entry with a -1, meaning they
+         * are empty */
+        for (size_t i = 0; i < MAX_FILE_BLOCKS; i++) {
+            inode_table[inumber].i_data_blocks[i] = -1;
+        }
+        /* the current data block is also initialized at -1, as we haven't
+         * actually used the data blocks */
+        inode_table[inumber].i_curr_block = -1;
+
+        /* the indirect blocks are also set to -1 */
+        inode_table[inumber].i_indir_block = -1;
+        inode_table[inumber].i_curr_indir = -1;
+        inode_table[inumber].i_dindir_block = -1;
+        inode_table[inumber].i_wgen = 0;
+
+        if (inode_unlock(inumber)) {
+            return -1;
+        }
+    }
+
+    return inumber;
+}
+
+/*
+ * Deletes the i-node.
+ * Input:
+ *  - inumber: i-node's number
+ * Returns: 0 if successful, -1 if failed
+ */
+int inode_delete(int inumber) {
+    // simulate storage access delay (to i-node and freeinode_ts)
+    insert_delay();
+    insert_delay();
+
+    if (!valid_inumber(inumber) || freeinode_ts[inumber] == FREE) {
+        return -1;
+    }
+
+    /* Gives the slot back to the shard it was taken from */
+    if (inode_slot_free(inumber) == -1) {
+        return -1;
+    }
+
+    if (inode_rdlock(inumber) == -1) {
+        return -1;
+    }
+
+    if (inode_table[inumber].i_size > 0) {
+        if (inode_unlock(inumber) == -1) {
+            return -1;
+        }
+
+        /* Free all the data blocks associated with the inode */
+        if(free_inode_blocks(inumber) == -1) {
+            return -1;
+        }
+    }
+    else {
+        if (inode_unlock(inumber) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Returns a pointer to an existing i-node.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: pointer if successful, NULL if failed
+ */
+inode_t *inode_get(int inumber) {
+    if (!valid_inumber(inumber)) {
+        return NULL;
+    }
+
+    insert_delay(); // simulate storage access delay to i-node
+    return &inode_table[inumber];
+}
+
+/*
+ * Adds an entry to the i-node directory data.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - sub_inumber: identifier of the sub i-node entry
+ *  - sub_name: name of the sub i-node entry
+ * Returns: SUCCESS or FAIL
+ */
+int add_dir_entry(int inumber, int sub_inumber, char const *sub_name) {
+    if (!valid_inumber(inumber) || !valid_inumber(sub_inumber)) {
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay to i-node with inumber
+    if (inode_table[inumber].i_node_type != T_DIRECTORY) {
+        return -1;
+    }
+
+    if (strlen(sub_name) == 0) {
+        return -1;
+    }
+
+    /* Protect the "data_block_get" function call */
+    if (inode_rdlock(inumber) == -1) {
+        return -1;
+    }
+
+    /* Locates the block containing the directory's entries. Index 0, since
+     * we are dealing with a directory */
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(inode_table[inumber].i_data_blocks[0]);
+    
+    if (dir_entry == NULL) {
+        inode_unlock(inumber);
+        return -1;
+    }
+
+    if (inode_unlock(inumber) == -1) {
+        return -1;
+    }
+
+    if (inode_wrlock(inumber) == -1) {
+        return -1;
+    }
+
+    /* The hash index gives us duplicate detection in O(1), instead of
+     * scanning the whole entry block for the name */
+    if (dir_index_lookup(inumber, sub_name) != -1) {
+        inode_unlock(inumber);
+        return -1;
+    }
+
+    /* Finds and fills the first empty entry */
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if (dir_entry[i].d_inumber == -1) {
+            dir_entry[i].d_inumber = sub_inumber;
+            strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
+            dir_entry[i].d_name[MAX_FILE_NAME - 1] = 0;
+
+            /* Mirrors the new entry in the directory's hash index */
+            if (dir_index_insert(inumber, sub_inumber, sub_name) == -1) {
+                dir_entry[i].d_inumber = -1;
+                inode_unlock(inumber);
+                return -1;
+            }
+
+            data_block_mark_dirty(inode_table[inumber].i_data_blocks[0]);
+
+            if (inode_unlock(inumber) == -1) {
+                return -1;
+            }
+            return 0;
+        }
+	}
+
+    inode_unlock(inumber);
+    return -1;
+}
+
+/* Looks for a given name inside a directory
+ * Input:
+ * 	- parent directory's i-node number
+ * 	- name to search
+ * 	Returns i-number linked to the target name, -1 if not found
+ */
+int find_in_dir(int inumber, char const *sub_name) {
+    insert_delay(); // simulate storage access delay to i-node with inumber
+    if (!valid_inumber(inumber) ||
+        inode_table[inumber].i_node_type != T_DIRECTORY) {
+        return -1;
+    }
+
+    /* We lock the i-node to protect the index from concurrent inserts */
+    if (inode_rdlock(inumber) == -1) {
+        return -1;
+    }
+
+    /* The hash index mirrors everything add_dir_entry wrote to the
+     * directory's entry block, so the answer comes straight from it
+     * without touching (and paying the storage delay for) the block */
+    int sub_inumber = dir_index_lookup(inumber, sub_name);
+
+    if (inode_unlock(inumber) == -1) {
+        return -1;
+    }
+
+    return sub_inumber;
+}
+
+/*
+ * Allocated a new data block
+ * Returns: block index if successful, -1 otherwise
+ */
+int data_block_alloc() {
+    insert_delay(); // simulate storage access delay to free_blocks
+
+	if (stat_rwlock_wrlock(&data_block_rwlock, STAT_LOCK_DATA_BLOCKS) != 0) {
+        return -1;
+    }
+
+    /* Pops the next free block from the stack, no scan needed */
+    if (free_block_sp > 0) {
+        int i = free_block_stack[--free_block_sp];
+        free_blocks[i] = TAKEN;
+        block_refcnt[i] = 1;
+
+        if (pthread_rwlock_unlock(&data_block_rwlock) != 0) {
+            return -1;
+        }
+
+        return i;
+    }
+
+	pthread_rwlock_unlock(&data_block_rwlock);
+    return -1;
+}
+
+/* Frees a data block
+ * Input
+ * 	- the block index
+ * Returns: 0 if success, -1 otherwise
+ */
+int data_block_free(int block_number) {
+    if (!valid_block_number(block_number)) {
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay to free_blocks
+
+    if (stat_rwlock_wrlock(&data_block_rwlock, STAT_LOCK_DATA_BLOCKS) != 0) {
+        return -1;
+    }
+
+    /* Drops one reference; the block only goes back on the free stack
+     * when the last one is gone (and only if it was actually taken,
+     * otherwise a double free would insert the same index twice) */
+    if (free_blocks[block_number] == TAKEN &&
+        --block_refcnt[block_number] <= 0) {
+        free_blocks[block_number] = FREE;
+        free_block_stack[free_block_sp++] = block_number;
+    }
+
+    if (pthread_rwlock_unlock(&data_block_rwlock) != 0) {
+        return -1;
+    }
+
+	return 0;
+}
+
+/* Takes an extra reference on a data block, so a clone can share it with
+ * the original file instead of copying it
+ * Input
+ * 	- the block index
+ * Returns: 0 if success, -1 otherwise
+ */
+int data_block_ref(int block_number) {
+    if (!valid_block_number(block_number)) {
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay to free_blocks
+
+    if (stat_rwlock_wrlock(&data_block_rwlock, STAT_LOCK_DATA_BLOCKS) != 0) {
+        return -1;
+    }
+
+    if (free_blocks[block_number] != TAKEN) {
+        pthread_rwlock_unlock(&data_block_rwlock);
+        return -1;
+    }
+    block_refcnt[block_number]++;
+
+    if (pthread_rwlock_unlock(&data_block_rwlock) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Returns how many i-node mappings currently reference a data block (a
+ * writer uses this to tell a shared block from an exclusive one before
+ * touching it), or -1 on an invalid block
+ */
+int data_block_refcount(int block_number) {
+    if (!valid_block_number(block_number)) {
+        return -1;
+    }
+
+    if (stat_rwlock_rdlock(&data_block_rwlock, STAT_LOCK_DATA_BLOCKS) != 0) {
+        return -1;
+    }
+
+    int count = block_refcnt[block_number];
+
+    if (pthread_rwlock_unlock(&data_block_rwlock) != 0) {
+        return -1;
+    }
+
+    return count;
+}
+
+/* Returns a pointer to the contents of a given block
+ * Input:
+ * 	- Block's index
+ * Returns: pointer to the first byte of the block, NULL otherwise
+ */
+void *data_block_get(int block_number) {
+    if (!valid_block_number(block_number)) {
+        return NULL;
+    }
+
+    insert_delay(); // simulate storage access delay to block
+
+    return &fs_data[(size_t)block_number * fs_block_size];
+}
+
+/* Marks a data block dirty for the write-back flusher. A no-op when the
+ * flusher isn't running, so the write paths can call it unconditionally
+ * Input:
+ * 	- Block's index
+ */
+void data_block_mark_dirty(int block_number) {
+    if (block_dirty == NULL || !valid_block_number(block_number)) {
+        return;
+    }
+
+    block_dirty[block_number] = 1;
+}
+
+/* Touches a data block so readahead can pull it in before the reader
+ * needs it. Only does anything on the mmap backend, where the touch
+ * faults the page in from the backing file; the in-memory backends have
+ * nothing to prefetch (and the touch deliberately skips the emulated
+ * delay, which models exactly the latency a prefetch is meant to hide)
+ * Input:
+ * 	- Block's index
+ */
+void data_block_prefetch(int block_number) {
+    if (fs_backend != TFS_BACKEND_MMAP || !valid_block_number(block_number)) {
+        return;
+    }
+
+    volatile char *block = &fs_data[(size_t)block_number * fs_block_size];
+    (void)*block;
+}
+
+/* Add new entry to the open file table
+ * Inputs:
+ * 	- I-node number of the file to open
+ * 	- Initial offset
+ * Returns: file handle if successful, -1 otherwise
+ */
+int add_to_open_file_table(int inumber, size_t offset) {
+    /* Rotates the starting shard between calls, just like
+     * inode_slot_alloc, so concurrent opens spread over the shards */
+    int start = (int)(atomic_fetch_add(&of_shard_hint, 1) % OPEN_FILE_SHARDS);
+    int fhandle = -1;
+
+    for (int i = 0; i < OPEN_FILE_SHARDS && fhandle == -1; i++) {
+        int s = (start + i) % OPEN_FILE_SHARDS;
+
+        if (stat_rwlock_wrlock(&of_shard_rwlocks[s], STAT_LOCK_OPEN_FILES) != 0) {
+            return -1;
+        }
+
+        if (free_of_sps[s] > 0) {
+            fhandle = free_of_stacks[s][--free_of_sps[s]];
+            free_open_file_entries[fhandle] = TAKEN;
+        }
+
+        if (pthread_rwlock_unlock(&of_shard_rwlocks[s]) != 0) {
+            return -1;
+        }
+    }
+
+    if (fhandle == -1) {
+        /* Every shard is out of free handles */
+        return -1;
+    }
+
+    /* Initializes the rwlock for the open file for future usage */
+    if (pthread_rwlock_init(&open_file_table[fhandle].of_lock, NULL) != 0) {
+        return -1;
+    }
+
+    /* We lock the open file to protect it during initialization */
+    if (of_wrlock(fhandle) == -1) {
+        return -1;
+    }
+
+    open_file_table[fhandle].of_inumber = inumber;
+    open_file_table[fhandle].of_offset = offset;
+
+    /* A fresh handle has no read history and no readahead yet */
+    open_file_table[fhandle].of_seq_next = offset;
+    open_file_table[fhandle].of_seq_streak = 0;
+    open_file_table[fhandle].of_ra_count = 0;
+
+    if (of_unlock(fhandle) == -1) {
+        return -1;
+    }
+
+    return fhandle;
+}
+
+/* Frees an entry from the open file table
+ * Inputs:
+ * 	- file handle to free/close
+ * Returns 0 is success, -1 otherwise
+ */
+int remove_from_open_file_table(int fhandle) {
+    if (!valid_file_handle(fhandle) ||
+        free_open_file_entries[fhandle] != TAKEN) {
+        return -1;
+    }
+
+    /* Since the file will be closed, we destroy the rwlock associated
+     * with it */
+    if (pthread_rwlock_destroy(&open_file_table[fhandle].of_lock) != 0) {
+       return -1;
+    }
+
+    /* Gives the handle back to the shard that owns it */
+    int s = fhandle / OF_SHARD_SPAN;
+
+    if (stat_rwlock_wrlock(&of_shard_rwlocks[s], STAT_LOCK_OPEN_FILES) != 0) {
+        return -1;
+    }
+
+    /* Only pushes the handle back on the shard's free stack if it was
+     * actually taken, otherwise a double close would insert it twice */
+    if (free_open_file_entries[fhandle] == TAKEN) {
+        free_open_file_entries[fhandle] = FREE;
+        free_of_stacks[s][free_of_sps[s]++] = fhandle;
+    }
+
+    if (pthread_rwlock_unlock(&of_shard_rwlocks[s]) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Returns pointer to a given entry in the open file table
+ * Inputs:
+ * 	 - file handle
+ * Returns: pointer to the entry if sucessful, NULL otherwise
+ */
+open_file_entry_t *get_open_file_entry(int fhandle) {
+    if (!valid_file_handle(fhandle)) {
+        return NULL;
+    }
+
+    return &open_file_table[fhandle];
+}
+
+/* Frees all the data blocks associated with an i-node
+ * Inputs:
+ *   - inumber: i-node's number
+ * Returns: 0 if successful -1 otherwise 
+ */
+int free_inode_blocks(int inumber) {
+    if (!valid_inumber(inumber)) {
+        return -1;
+    }
+
+    /* A write lock, since besides freeing the blocks the mapping itself
+     * is reset (entries back to -1), so a truncated i-node can't keep
+     * stale references to blocks that were given back to the pool */
+    if (inode_wrlock(inumber) == -1) {
+        return -1;
+    }
+
+    /* The whole mapping is about to change: invalidate readahead caches */
+    inode_table[inumber].i_wgen++;
+
+    /* Free all the direct referenced data blocks associated with
+     * the inode (entries still at -1 were never allocated) */
+    for(size_t i = 0; i < MAX_FILE_BLOCKS; i++) {
+        if (inode_table[inumber].i_data_blocks[i] != -1) {
+            if (data_block_free(inode_table[inumber].i_data_blocks[i]) == -1) {
+                inode_unlock(inumber);
+                return -1;
+            }
+            inode_table[inumber].i_data_blocks[i] = -1;
+        }
+    }
+
+    /* If we have an indirect block allocated we free it */
+    if (inode_table[inumber].i_indir_block != -1) {
+        /* We get the indirect block */
+        int *block = (int *)data_block_get(inode_table[inumber].i_indir_block);
+        if (block == NULL) {
+            inode_unlock(inumber);
+            return -1;
+        }
+
+        /* Free all the blocks in the indirect block */
+        for (size_t i = 0; i < INDIR_BLOCK_SIZE; i++) {
+            if (block[i] != -1 && data_block_free(block[i]) == -1) {
+                inode_unlock(inumber);
+                return -1;
+            }
+        }
+
+        /* Free the data block itself */
+        if (data_block_free(inode_table[inumber].i_indir_block) == -1) {
+            inode_unlock(inumber);
+            return -1;
+        }
+        inode_table[inumber].i_indir_block = -1;
+    }
+
+    /* The double indirect block takes one extra level: each of its
+     * entries is itself an indirect block full of data block references */
+    if (inode_table[inumber].i_dindir_block != -1) {
+        int *outer = (int *)data_block_get(inode_table[inumber].i_dindir_block);
+        if (outer == NULL) {
+            inode_unlock(inumber);
+            return -1;
+        }
+
+        for (size_t i = 0; i < INDIR_BLOCK_SIZE; i++) {
+            if (outer[i] == -1) {
+                continue;
+            }
+
+            int *inner = (int *)data_block_get(outer[i]);
+            if (inner == NULL) {
+                inode_unlock(inumber);
+                return -1;
+            }
+
+            for (size_t j = 0; j < INDIR_BLOCK_SIZE; j++) {
+                if (inner[j] != -1 && data_block_free(inner[j]) == -1) {
+                    inode_unlock(inumber);
+                    return -1;
+                }
+            }
+
+            if (data_block_free(outer[i]) == -1) {
+                inode_unlock(inumber);
+                return -1;
+            }
+            outer[i] = -1;
+        }
+
+        if (data_block_free(inode_table[inumber].i_dindir_block) == -1) {
+            inode_unlock(inumber);
+            return -1;
+        }
+        inode_table[inumber].i_dindir_block = -1;
+    }
+
+    /* The block cursors go back to their "empty file" values */
+    inode_table[inumber].i_curr_block = -1;
+    inode_table[inumber].i_curr_indir = -1;
+
+    if (inode_unlock(inumber) == -1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Applies a read-lock to the i-node's rwlock
+ * Inputs:
+ *   - inumber: i-node's number
+ * Returns: 0 if successful -1 otherwise 
+ */
+int inode_rdlock(int inumber) {
+    if (!valid_inumber(inumber)) {
+        return -1;
+    }
+
+    if (stat_rwlock_rdlock(&inode_locks[inumber].pl_lock, STAT_LOCK_INODES) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Applies a write-lock to the i-node's rwlock
+ * Inputs:
+ *   - inumber: i-node's number
+ * Returns: 0 if successful -1 otherwise 
+ */
+int inode_wrlock(int inumber) {
+    if (!valid_inumber(inumber)) {
+        return -1;
+    }
+
+    if (stat_rwlock_wrlock(&inode_locks[inumber].pl_lock, STAT_LOCK_INODES) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Unlocks the i-node's rwlock
+ * Inputs:
+ *   - inumber: i-node's number
+ * Returns: 0 if successful -1 otherwise 
+ */
+int inode_unlock(int inumber) {
+    if (!valid_inumber(inumber)) {
+        return -1;
+    }
+
+    if (pthread_rwlock_unlock(&inode_locks[inumber].pl_lock) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Applies a read-lock to the file's rwlock
+ * Returns: 0 if successful -1 otherwise 
+ */
+int of_rdlock(int fhandle) {
+    if (!valid_file_handle(fhandle)) {
+        return -1;
+    }
+
+    if (stat_rwlock_rdlock(&open_file_table[fhandle].of_lock, STAT_LOCK_OPEN_FILES) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Applies a write-lock to the file's rwlock
+ * Returns: 0 if successful -1 otherwise 
+ */
+int of_wrlock(int fhandle) {
+    if (!valid_file_handle(fhandle)) {
+        return -1;
+    }
+
+    if (stat_rwlock_wrlock(&open_file_table[fhandle].of_lock, STAT_LOCK_OPEN_FILES) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Unlocks the file's rwlock
+ * Returns: 0 if successful -1 otherwise 
+ */
+int of_unlock(int fhandle) {
+    if (!valid_file_handle(fhandle)) {
+        return -1;
+    }
+
+    if (pthread_rwlock_unlock(&open_file_table[fhandle].of_lock) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -1,90 +1,246 @@
-#ifndef STATE_H
-#define STATE_H
-
-#include "config.h"
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <sys/types.h>
-#include <pthread.h>
-
-/*
- * Directory entry
- */
-typedef struct {
-    char d_name[MAX_FILE_NAME];
-    int d_inumber;
-} dir_entry_t;
-
-typedef enum { T_FILE, T_DIRECTORY } inode_type;
-
-/*
- * I-node
- */
-typedef struct {
-    inode_type i_node_type;
-    size_t i_size;
-
-    /* array of data blocks, if the inode is associated with a file,
-     * i_data_blocks will store up to 10 direct referenced data blocks (their indexes), 
-     * if inode is a directory, it will only store 1 data block */
-    int i_data_blocks[MAX_FILE_BLOCKS];
-    int i_curr_block;
-
-    /* Stores the index of the indirect referenced data block to be used by a file,
-     * if necessary */
-    int i_indir_block;
-    int i_curr_indir;
-
-    /* I-node's lock */
-    pthread_rwlock_t i_lock;
-} inode_t;
-
-typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
-
-/*
- * Open file entry (in open file table)
- */
-typedef struct {
-    int of_inumber;
-    size_t of_offset;
-
-    /* Open file lock */
-    pthread_rwlock_t of_lock;
-} open_file_entry_t;
-
-#define INDIR_BLOCK_SIZE (BLOCK_SIZE / sizeof(int))
-#define MAX_DIR_ENTRIES (BLOCK_SIZE / sizeof(dir_entry_t))
-
-void state_init();
-void state_destroy();
-
-int inode_create(inode_type n_type);
-int inode_delete(int inumber);
-inode_t *inode_get(int inumber);
-
-int clear_dir_entry(int inumber, int sub_inumber);
-int add_dir_entry(int inumber, int sub_inumber, char const *sub_name);
-int find_in_dir(int inumber, char const *sub_name);
-
-int data_block_alloc();
-int data_block_free(int block_number);
-void *data_block_get(int block_number);
-
-int add_to_open_file_table(int inumber, size_t offset);
-int remove_from_open_file_table(int fhandle);
-open_file_entry_t *get_open_file_entry(int fhandle);
-
-/* New methods */
-
-int free_inode_blocks(int inumber);
-
-int inode_rdlock(int inumber);
-int inode_wrlock(int inumber);
-int inode_unlock(int inumber);
-
-int of_rdlock(int fhandle);
-int of_wrlock(int fhandle);
-int of_unlock(int fhandle);
-
-#endif // STATE_H
+#ifndef STATE_H
+#define STATE_H
+
+#include "config.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+/*
+ * Directory entry
+ */
+typedef struct {
+    char d_name[MAX_FILE_NAME];
+    int d_inumber;
+} dir_entry_t;
+
+typedef enum { T_FILE, T_DIRECTORY } inode_type;
+
+/*
+ * Storage backend, chosen once at startup:
+ *  - TFS_BACKEND_EMULATED keeps the historical behavior of busy-waiting
+ *    DELAY iterations before every table access, emulating the latency
+ *    of secondary storage (the default, so old callers see no change)
+ *  - TFS_BACKEND_RAM skips the artificial delay entirely, for in-memory
+ *    cache-tier deployments where the burnt CPU buys nothing
+ *  - TFS_BACKEND_MMAP does the same but requires a backing_file, so the
+ *    "delay" is the real I/O the mapped store (and tfs_sync) performs
+ */
+typedef enum {
+    TFS_BACKEND_EMULATED = 0,
+    TFS_BACKEND_RAM,
+    TFS_BACKEND_MMAP,
+} tfs_backend_t;
+
+/*
+ * Filesystem geometry, chosen once at startup. The config.h macros only
+ * provide the values tfs_init() defaults to; tfs_init_with_params() can
+ * size the tables differently without recompiling
+ */
+typedef struct {
+    size_t block_size;
+    size_t data_blocks;
+    int inode_table_size;
+    int max_open_files;
+
+    /* Path of the file backing the persistent state (block store, i-node
+     * table and free maps); NULL keeps everything in anonymous memory,
+     * like before. An existing store is loaded, a missing one is created */
+    char const *backing_file;
+
+    /* How table accesses behave (see tfs_backend_t above); the zero
+     * value keeps the emulated-delay behavior */
+    tfs_backend_t backend;
+
+    /* Interval (in milliseconds) of the background write-back flusher,
+     * which tracks dirty data blocks and periodically msyncs them to the
+     * backing file in batched sequential ranges. 0 disables it: the
+     * store is then only pushed out by explicit tfs_sync() calls.
+     * Ignored without a backing_file */
+    size_t flush_interval_ms;
+} tfs_params;
+
+/* The geometry currently in effect (set by state_init_with_params) */
+extern size_t fs_block_size;
+extern size_t fs_data_blocks;
+extern int fs_inode_table_size;
+extern int fs_max_open_files;
+
+/*
+ * Filesystem statistics, filled in by tfs_get_stats(): operation counts
+ * and bytes moved since the filesystem was initialized, how full each
+ * allocator is right now, and how long threads have spent blocked on
+ * each lock family (waiting only; time spent holding a lock is not
+ * counted)
+ */
+typedef struct {
+    /* Operation counts (tfs_pread / tfs_pwrite count as reads / writes) */
+    size_t open_calls;
+    size_t close_calls;
+    size_t read_calls;
+    size_t write_calls;
+
+    /* Bytes successfully moved by the calls above */
+    size_t bytes_read;
+    size_t bytes_written;
+
+    /* Allocator occupancy at the time of the call */
+    size_t inodes_used;
+    size_t inodes_total;
+    size_t data_blocks_used;
+    size_t data_blocks_total;
+    size_t open_files_used;
+    size_t open_files_total;
+
+    /* Cumulative lock-wait time, in nanoseconds */
+    size_t lock_wait_inode_table_ns;
+    size_t lock_wait_data_blocks_ns;
+    size_t lock_wait_open_files_ns;
+    size_t lock_wait_inodes_ns;
+} tfs_stats;
+
+/* The lock families whose wait time is tracked separately (the open
+ * file family covers both the table's shard locks and the per-entry
+ * of_locks) */
+typedef enum {
+    STAT_LOCK_INODE_TABLE = 0,
+    STAT_LOCK_DATA_BLOCKS,
+    STAT_LOCK_OPEN_FILES,
+    STAT_LOCK_INODES,
+
+    STAT_LOCK_FAMILIES
+} stat_lock_family_t;
+
+/* One thread's private slice of the statistics: bumping a counter is a
+ * plain unsynchronized increment, and tfs_get_stats() sums the slices
+ * of every thread that ever touched the filesystem */
+typedef struct thread_stats {
+    size_t open_calls;
+    size_t close_calls;
+    size_t read_calls;
+    size_t write_calls;
+    size_t bytes_read;
+    size_t bytes_written;
+
+    size_t lock_wait_ns[STAT_LOCK_FAMILIES];
+
+    struct thread_stats *next;
+} thread_stats_t;
+
+/*
+ * I-node
+ */
+typedef struct {
+    inode_type i_node_type;
+    size_t i_size;
+
+    /* array of data blocks, if the inode is associated with a file,
+     * i_data_blocks will store up to 10 direct referenced data blocks (their indexes), 
+     * if inode is a directory, it will only store 1 data block */
+    int i_data_blocks[MAX_FILE_BLOCKS];
+    int i_curr_block;
+
+    /* Stores the index of the indirect referenced data block to be used by a file,
+     * if necessary */
+    int i_indir_block;
+    int i_curr_indir;
+
+    /* Stores the index of the double indirect block (a block of references
+     * to indirect blocks, each of those referencing data blocks), used once
+     * a file grows past the direct + single indirect capacity */
+    int i_dindir_block;
+
+    /* Write generation: bumped (under the write lock) every time the
+     * block mapping may change, so per-handle readahead caches can tell
+     * whether their resolved block numbers are still valid */
+    size_t i_wgen;
+
+    /* Note: the i-node's lock does NOT live here. The locks sit in a
+     * separate cache-line-padded array in state.c (see inode_locks), so
+     * the frequently written lock words never share a cache line with
+     * this read-mostly metadata or with an adjacent i-node's lock, and
+     * scans over the table touch only compact records */
+} inode_t;
+
+typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
+
+/*
+ * Open file entry (in open file table)
+ */
+typedef struct {
+    int of_inumber;
+
+    /* Current offset, maintained with atomic operations so the sequential
+     * read/write path never takes of_lock: each transfer reserves its
+     * range with one fetch-add and gives back whatever it couldn't use */
+    _Atomic size_t of_offset;
+
+    /* Sequential access detection and readahead, all guarded by of_lock
+     * (taken after the i-node lock, never before): of_seq_next is where
+     * the next read lands if the stream stays sequential, and once the
+     * streak is long enough the next READAHEAD_BLOCKS block numbers are
+     * resolved ahead of time into of_ra_blocks. of_ra_wgen remembers the
+     * i-node's write generation at fill time, so a remapped block (e.g.
+     * copy-on-write) invalidates the cache instead of serving stale
+     * numbers */
+    size_t of_seq_next;
+    int of_seq_streak;
+    size_t of_ra_start;
+    int of_ra_count;
+    size_t of_ra_wgen;
+    int of_ra_blocks[READAHEAD_BLOCKS];
+
+    /* Open file lock (open/close lifecycle only plus the readahead
+     * bookkeeping above, the per-I/O data path doesn't touch it) */
+    pthread_rwlock_t of_lock;
+} open_file_entry_t;
+
+#define INDIR_BLOCK_SIZE (fs_block_size / sizeof(int))
+#define MAX_DIR_ENTRIES (fs_block_size / sizeof(dir_entry_t))
+
+int state_init();
+int state_init_with_params(tfs_params const *params);
+void state_destroy();
+int state_sync();
+int state_export(char const *path);
+int state_import(char const *path);
+
+int inode_create(inode_type n_type);
+int inode_delete(int inumber);
+inode_t *inode_get(int inumber);
+
+int clear_dir_entry(int inumber, int sub_inumber);
+int add_dir_entry(int inumber, int sub_inumber, char const *sub_name);
+int find_in_dir(int inumber, char const *sub_name);
+
+int data_block_alloc();
+int data_block_free(int block_number);
+int data_block_ref(int block_number);
+int data_block_refcount(int block_number);
+void *data_block_get(int block_number);
+void data_block_mark_dirty(int block_number);
+void data_block_prefetch(int block_number);
+
+int add_to_open_file_table(int inumber, size_t offset);
+int remove_from_open_file_table(int fhandle);
+open_file_entry_t *get_open_file_entry(int fhandle);
+
+/* New methods */
+
+int free_inode_blocks(int inumber);
+
+int inode_rdlock(int inumber);
+int inode_wrlock(int inumber);
+int inode_unlock(int inumber);
+
+int of_rdlock(int fhandle);
+int of_wrlock(int fhandle);
+int of_unlock(int fhandle);
+
+thread_stats_t *state_thread_stats();
+void state_stats_aggregate(tfs_stats *stats);
+
+#endif // STATE_H
@@ -0,0 +1,56 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+#define COUNT 20
+#define SIZE 1024
+
+/**
+   This test brings the filesystem up with the RAM backend (no emulated
+   storage delay) and checks everything still behaves the same, and that
+   the mmap backend is rejected when no backing file is given
+ */
+
+int main() {
+
+    char *path = "/f1";
+
+    tfs_params params = {
+        .block_size = 1024,
+        .data_blocks = 1024,
+        .inode_table_size = 50,
+        .max_open_files = 20,
+        .backend = TFS_BACKEND_RAM,
+    };
+
+    char input[SIZE];
+    memset(input, 'A', SIZE);
+
+    char output [SIZE];
+
+    assert(tfs_init_with_params(&params) != -1);
+
+    int fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+    for (int i = 0; i < COUNT; i++) {
+        assert(tfs_write(fd, input, SIZE) == SIZE);
+    }
+    assert(tfs_close(fd) != -1);
+
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    for (int i = 0; i < COUNT; i++) {
+        assert(tfs_read(fd, output, SIZE) == SIZE);
+        assert(memcmp(input, output, SIZE) == 0);
+    }
+    assert(tfs_close(fd) != -1);
+
+    /* The mmap backend needs a file to map */
+    tfs_params bad_params = params;
+    bad_params.backend = TFS_BACKEND_MMAP;
+    assert(tfs_init_with_params(&bad_params) == -1);
+
+    printf("Sucessful test\n");
+
+    return 0;
+}
@@ -0,0 +1,233 @@
+#include "fs/operations.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+   Benchmark harness for the fs/ library: drives a configurable mix of
+   block-sized pwrites and preads from several threads against a set of
+   pre-created files and reports throughput and latency percentiles per
+   operation type, so performance changes between revisions can be
+   quantified instead of guessed.
+
+   Usage: bench [threads [files [blocks_per_file [write_pct]]]]
+
+   The RAM backend is used so the numbers measure the filesystem's own
+   work, not the emulated storage delay.
+ */
+
+#define SIZE (1024)
+#define OPS_PER_THREAD (2000)
+
+#define DEFAULT_THREADS (4)
+#define DEFAULT_FILES (16)
+#define DEFAULT_BLOCKS (8)
+#define DEFAULT_WRITE_PCT (50)
+
+static int n_files;
+static int n_blocks;
+static int write_pct;
+static int *fds;
+
+typedef struct {
+    unsigned int seed;
+
+    /* One latency (in nanoseconds) per operation performed */
+    long *write_ns;
+    size_t write_count;
+    long *read_ns;
+    size_t read_count;
+} bench_thread_t;
+
+static long elapsed_ns(struct timespec const *t0, struct timespec const *t1) {
+    return (t1->tv_sec - t0->tv_sec) * 1000000000L +
+           (t1->tv_nsec - t0->tv_nsec);
+}
+
+static void *bench_worker(void *arg) {
+    bench_thread_t *self = (bench_thread_t *)arg;
+
+    char buffer[SIZE];
+    memset(buffer, 'B', SIZE);
+
+    struct timespec t0;
+    struct timespec t1;
+
+    for (int op = 0; op < OPS_PER_THREAD; op++) {
+        int file = (int)((unsigned int)rand_r(&self->seed) % (unsigned int)n_files);
+        size_t block = (size_t)((unsigned int)rand_r(&self->seed) % (unsigned int)n_blocks);
+        int is_write = (int)((unsigned int)rand_r(&self->seed) % 100u) < write_pct;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (is_write) {
+            if (tfs_pwrite(fds[file], buffer, SIZE, block * SIZE) != SIZE) {
+                return (void *)-1;
+            }
+        } else {
+            if (tfs_pread(fds[file], buffer, SIZE, block * SIZE) != SIZE) {
+                return (void *)-1;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        if (is_write) {
+            self->write_ns[self->write_count++] = elapsed_ns(&t0, &t1);
+        } else {
+            self->read_ns[self->read_count++] = elapsed_ns(&t0, &t1);
+        }
+    }
+
+    return NULL;
+}
+
+static int cmp_long(void const *a, void const *b) {
+    long la = *(long const *)a;
+    long lb = *(long const *)b;
+    return (la > lb) - (la < lb);
+}
+
+static long percentile(long const *sorted, size_t count, int pct) {
+    if (count == 0) {
+        return 0;
+    }
+    size_t index = (count * (size_t)pct + 99) / 100;
+    if (index > 0) {
+        index--;
+    }
+    return sorted[index];
+}
+
+static void report(char const *name, long *ns, size_t count, double seconds) {
+    qsort(ns, count, sizeof(long), cmp_long);
+
+    printf("%-7s %8zu ops  %10.0f ops/s  "
+           "p50 %6.1f us  p95 %6.1f us  p99 %6.1f us\n",
+           name, count, (double)count / seconds,
+           (double)percentile(ns, count, 50) / 1000.0,
+           (double)percentile(ns, count, 95) / 1000.0,
+           (double)percentile(ns, count, 99) / 1000.0);
+}
+
+int main(int argc, char **argv) {
+
+    int n_threads = (argc > 1) ? atoi(argv[1]) : DEFAULT_THREADS;
+    n_files = (argc > 2) ? atoi(argv[2]) : DEFAULT_FILES;
+    n_blocks = (argc > 3) ? atoi(argv[3]) : DEFAULT_BLOCKS;
+    write_pct = (argc > 4) ? atoi(argv[4]) : DEFAULT_WRITE_PCT;
+
+    if (n_threads < 1 || n_files < 1 || n_blocks < 1 ||
+        write_pct < 0 || write_pct > 100) {
+        fprintf(stderr,
+                "usage: bench [threads [files [blocks_per_file [write_pct]]]]\n");
+        return 1;
+    }
+
+    tfs_params params = {
+        .block_size = SIZE,
+        .data_blocks = (size_t)(n_files * n_blocks) + (size_t)n_files * 2 + 8,
+        .inode_table_size = (size_t)n_files + 2,
+        .max_open_files = (size_t)n_files + 2,
+        .backend = TFS_BACKEND_RAM,
+    };
+
+    if (tfs_init_with_params(&params) == -1) {
+        fprintf(stderr, "bench: tfs_init failed\n");
+        return 1;
+    }
+
+    /* Setup (untimed): creates the files at full size */
+    char buffer[SIZE];
+    memset(buffer, 'A', SIZE);
+
+    fds = malloc((size_t)n_files * sizeof(int));
+    if (fds == NULL) {
+        return 1;
+    }
+
+    for (int i = 0; i < n_files; i++) {
+        char path[32];
+        snprintf(path, sizeof(path), "/bench%d", i);
+
+        fds[i] = tfs_open(path, TFS_O_CREAT);
+        if (fds[i] == -1) {
+            fprintf(stderr, "bench: setup failed\n");
+            return 1;
+        }
+        for (int b = 0; b < n_blocks; b++) {
+            if (tfs_write(fds[i], buffer, SIZE) != SIZE) {
+                fprintf(stderr, "bench: setup failed\n");
+                return 1;
+            }
+        }
+    }
+
+    /* The measured run */
+    pthread_t threads[n_threads];
+    bench_thread_t args[n_threads];
+
+    for (int i = 0; i < n_threads; i++) {
+        args[i].seed = (unsigned int)(i + 1);
+        args[i].write_ns = malloc(OPS_PER_THREAD * sizeof(long));
+        args[i].write_count = 0;
+        args[i].read_ns = malloc(OPS_PER_THREAD * sizeof(long));
+        args[i].read_count = 0;
+        if (args[i].write_ns == NULL || args[i].read_ns == NULL) {
+            return 1;
+        }
+    }
+
+    struct timespec run_t0;
+    struct timespec run_t1;
+    clock_gettime(CLOCK_MONOTONIC, &run_t0);
+
+    for (int i = 0; i < n_threads; i++) {
+        if (pthread_create(&threads[i], NULL, bench_worker, &args[i]) != 0) {
+            return 1;
+        }
+    }
+
+    int failed = 0;
+    for (int i = 0; i < n_threads; i++) {
+        void *ret;
+        pthread_join(threads[i], &ret);
+        if (ret != NULL) {
+            failed = 1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &run_t1);
+
+    if (failed) {
+        fprintf(stderr, "bench: an operation failed mid-run\n");
+        return 1;
+    }
+
+    /* Merges the per-thread samples and reports per operation type */
+    long *write_ns = malloc((size_t)n_threads * OPS_PER_THREAD * sizeof(long));
+    long *read_ns = malloc((size_t)n_threads * OPS_PER_THREAD * sizeof(long));
+    if (write_ns == NULL || read_ns == NULL) {
+        return 1;
+    }
+
+    size_t write_count = 0;
+    size_t read_count = 0;
+    for (int i = 0; i < n_threads; i++) {
+        memcpy(write_ns + write_count, args[i].write_ns,
+               args[i].write_count * sizeof(long));
+        write_count += args[i].write_count;
+        memcpy(read_ns + read_count, args[i].read_ns,
+               args[i].read_count * sizeof(long));
+        read_count += args[i].read_count;
+    }
+
+    double seconds = (double)elapsed_ns(&run_t0, &run_t1) / 1e9;
+
+    printf("bench: %d threads, %d files x %d blocks, %d%% writes, %.3fs\n",
+           n_threads, n_files, n_blocks, write_pct, seconds);
+    report("writes", write_ns, write_count, seconds);
+    report("reads", read_ns, read_count, seconds);
+
+    return 0;
+}
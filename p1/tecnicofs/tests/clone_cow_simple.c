@@ -0,0 +1,87 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+#define BLOCKS 15
+#define SIZE 1024
+
+/**
+   This test clones a 15-block file (spilling into the indirect block) and
+   checks the clone reads back identical, and then writes to each side to
+   make sure copy-on-write keeps the two files independent
+ */
+
+int main() {
+
+    char *path = "/f1";
+    char *clone = "/f2";
+
+    char input[SIZE];
+    memset(input, 'A', SIZE);
+
+    char output [SIZE];
+
+    assert(tfs_init() != -1);
+
+    int fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+    for (int i = 0; i < BLOCKS; i++) {
+        assert(tfs_write(fd, input, SIZE) == SIZE);
+    }
+    assert(tfs_close(fd) != -1);
+
+    /* The clone shares the original's blocks, no contents copied */
+    assert(tfs_clone(path, clone) == 0);
+
+    /* Cloning over an existing file (or from a missing one) must fail */
+    assert(tfs_clone(path, clone) == -1);
+    assert(tfs_clone("/missing", "/f3") == -1);
+
+    fd = tfs_open(clone, 0);
+    assert(fd != -1);
+    for (int i = 0; i < BLOCKS; i++) {
+        assert(tfs_read(fd, output, SIZE) == SIZE);
+        assert(memcmp(input, output, SIZE) == 0);
+    }
+    assert(tfs_close(fd) != -1);
+
+    /* Writing the clone's first block must not touch the original... */
+    char patch[SIZE];
+    memset(patch, 'B', SIZE);
+
+    fd = tfs_open(clone, 0);
+    assert(fd != -1);
+    assert(tfs_write(fd, patch, SIZE) == SIZE);
+    assert(tfs_close(fd) != -1);
+
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, output, SIZE) == SIZE);
+    assert(memcmp(input, output, SIZE) == 0);
+    assert(tfs_close(fd) != -1);
+
+    /* ...and overwriting a still-shared block of the original (the
+       second one, which the clone never touched) must not reach the
+       clone either */
+    char patch2[SIZE];
+    memset(patch2, 'C', SIZE);
+
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_pwrite(fd, patch2, SIZE, SIZE) == SIZE);
+    assert(tfs_close(fd) != -1);
+
+    fd = tfs_open(clone, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, output, SIZE) == SIZE);
+    assert(memcmp(patch, output, SIZE) == 0);
+    for (int i = 1; i < BLOCKS; i++) {
+        assert(tfs_read(fd, output, SIZE) == SIZE);
+        assert(memcmp(input, output, SIZE) == 0);
+    }
+    assert(tfs_close(fd) != -1);
+
+    printf("Sucessful test\n");
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+#define COUNT 30
+#define SIZE 512
+
+/**
+   This test writes a file, exports the whole filesystem to an image,
+   wipes everything with a fresh init, and then imports the image to check
+   the file (and the free maps) came back exactly as exported
+ */
+
+int main() {
+
+    char *path = "/f1";
+    char *image = "export_import_simple.img";
+
+    char input[SIZE];
+    memset(input, 'A', SIZE);
+
+    char output [SIZE];
+
+    assert(tfs_init() != -1);
+
+    int fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+    for (int i = 0; i < COUNT; i++) {
+        assert(tfs_write(fd, input, SIZE) == SIZE);
+    }
+    assert(tfs_close(fd) != -1);
+
+    /* Snapshots the whole filesystem in one go */
+    assert(tfs_export(image) == 0);
+
+    /* A fresh init wipes the file... */
+    assert(tfs_init() != -1);
+    assert(tfs_open(path, 0) == -1);
+
+    /* ...and the import brings it back, contents intact */
+    assert(tfs_import(image) == 0);
+
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    for (int i = 0; i < COUNT; i++) {
+        assert(tfs_read(fd, output, SIZE) == SIZE);
+        assert(memcmp(input, output, SIZE) == 0);
+    }
+    assert(tfs_close(fd) != -1);
+
+    /* New files can still be created, since the free maps came along */
+    fd = tfs_open("/f2", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, input, SIZE) == SIZE);
+    assert(tfs_close(fd) != -1);
+
+    /* Garbage is not an image */
+    assert(tfs_import("/dev/null") == -1);
+
+    unlink(image);
+
+    printf("Sucessful test\n");
+
+    return 0;
+}
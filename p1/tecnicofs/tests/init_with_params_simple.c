@@ -0,0 +1,63 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+#define SIZE 4096
+#define COUNT 20
+
+/**
+   This test brings the filesystem up with a non-default geometry (4KB
+   blocks and larger tables than config.h's defaults) and checks that
+   writes and reads line up with the requested block size
+ */
+
+int main() {
+
+    char *path = "/f1";
+
+    tfs_params params = {
+        .block_size = 4096,
+        .data_blocks = 2048,
+        .inode_table_size = 100,
+        .max_open_files = 100,
+    };
+
+    char input[SIZE];
+    memset(input, 'A', SIZE);
+
+    char output [SIZE];
+
+    assert(tfs_init_with_params(&params) != -1);
+
+    /* Each write fills exactly one of the 4KB blocks */
+    int fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+    for (int i = 0; i < COUNT; i++) {
+        assert(tfs_write(fd, input, SIZE) == SIZE);
+    }
+    assert(tfs_close(fd) != -1);
+
+    /* Open again to check if contents are as expected */
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+
+    for (int i = 0; i < COUNT; i++) {
+        assert(tfs_read(fd, output, SIZE) == SIZE);
+        assert(memcmp(input, output, SIZE) == 0);
+    }
+
+    assert(tfs_close(fd) != -1);
+
+    /* A geometry that makes no sense has to be rejected */
+    tfs_params bad_params = {
+        .block_size = 0,
+        .data_blocks = 2048,
+        .inode_table_size = 100,
+        .max_open_files = 100,
+    };
+    assert(tfs_init_with_params(&bad_params) == -1);
+
+    printf("Sucessful test\n");
+
+    return 0;
+}
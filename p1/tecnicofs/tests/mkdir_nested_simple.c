@@ -0,0 +1,59 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+#define SIZE 1024
+
+/**
+   This test builds a small directory tree with tfs_mkdir and checks that
+   files can be created, written and read inside nested directories, and
+   that path resolution rejects the obvious nonsense
+ */
+
+int main() {
+
+    char *path = "/a/b/f1";
+
+    char input[SIZE];
+    memset(input, 'A', SIZE);
+
+    char output [SIZE];
+
+    assert(tfs_init() != -1);
+
+    assert(tfs_mkdir("/a") == 0);
+    assert(tfs_mkdir("/a/b") == 0);
+
+    /* The same directory can't be created twice... */
+    assert(tfs_mkdir("/a") == -1);
+
+    /* ...and intermediate components have to exist already */
+    assert(tfs_mkdir("/missing/c") == -1);
+
+    int fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, input, SIZE) == SIZE);
+    assert(tfs_close(fd) != -1);
+
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, output, SIZE) == SIZE);
+    assert(memcmp(input, output, SIZE) == 0);
+    assert(tfs_close(fd) != -1);
+
+    /* The same name in different directories means different files */
+    fd = tfs_open("/a/f1", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_close(fd) != -1);
+    assert(tfs_lookup("/a/f1") != tfs_lookup("/a/b/f1"));
+
+    /* A file in the middle of a path is not a directory */
+    assert(tfs_open("/a/f1/x", TFS_O_CREAT) == -1);
+
+    /* Missing files in an existing directory still fail without CREAT */
+    assert(tfs_open("/a/b/missing", 0) == -1);
+
+    printf("Sucessful test\n");
+
+    return 0;
+}
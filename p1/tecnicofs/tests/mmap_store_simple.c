@@ -0,0 +1,75 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+#define COUNT 40
+#define SIZE 256
+
+/**
+   This test brings the filesystem up backed by an mmap'd store file,
+   writes a file, syncs and tears everything down, and then brings the
+   filesystem up again from the same store to check the contents (and the
+   free maps) survived the "restart"
+ */
+
+int main() {
+
+    char *path = "/f1";
+    char *store = "mmap_store_simple.store";
+
+    /* Starts from a clean slate, in case a previous run left its store
+       behind */
+    unlink(store);
+
+    tfs_params params = {
+        .block_size = 1024,
+        .data_blocks = 1024,
+        .inode_table_size = 50,
+        .max_open_files = 20,
+        .backing_file = store,
+    };
+
+    char input[SIZE];
+    memset(input, 'A', SIZE);
+
+    char output [SIZE];
+
+    assert(tfs_init_with_params(&params) != -1);
+
+    int fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+    for (int i = 0; i < COUNT; i++) {
+        assert(tfs_write(fd, input, SIZE) == SIZE);
+    }
+    assert(tfs_close(fd) != -1);
+
+    /* Pushes everything to the store and shuts the filesystem down,
+       simulating a restart */
+    assert(tfs_sync() == 0);
+    assert(tfs_destroy() == 0);
+
+    /* Comes back up from the same store: the file has to still be there,
+       contents intact */
+    assert(tfs_init_with_params(&params) != -1);
+
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    for (int i = 0; i < COUNT; i++) {
+        assert(tfs_read(fd, output, SIZE) == SIZE);
+        assert(memcmp(input, output, SIZE) == 0);
+    }
+    assert(tfs_close(fd) != -1);
+
+    /* New files can still be created, since the free maps came along */
+    fd = tfs_open("/f2", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, input, SIZE) == SIZE);
+    assert(tfs_close(fd) != -1);
+
+    unlink(store);
+
+    printf("Sucessful test\n");
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+
+#define THREADS 4
+#define REGION_SIZE 2048
+
+/**
+   This test fans THREADS threads out over one open file, each writing its
+   own disjoint region through tfs_pwrite on the shared handle, and then
+   reading every region back through tfs_pread. The handle's own offset is
+   never touched by the positional calls, so it must still be 0 at the end
+ */
+
+static int fd;
+
+void *region_writer(void *args) {
+
+    size_t id = *(size_t *)args;
+    size_t offset = id * REGION_SIZE;
+
+    char input[REGION_SIZE];
+    memset(input, 'A' + (char)id, REGION_SIZE);
+
+    assert(tfs_pwrite(fd, input, REGION_SIZE, offset) == REGION_SIZE);
+
+    return NULL;
+}
+
+void *region_reader(void *args) {
+
+    size_t id = *(size_t *)args;
+    size_t offset = id * REGION_SIZE;
+
+    char expected[REGION_SIZE];
+    memset(expected, 'A' + (char)id, REGION_SIZE);
+
+    char output[REGION_SIZE];
+    assert(tfs_pread(fd, output, REGION_SIZE, offset) == REGION_SIZE);
+    assert(memcmp(expected, output, REGION_SIZE) == 0);
+
+    return NULL;
+}
+
+int main() {
+
+    char *path = "/f1";
+
+    pthread_t tid[THREADS];
+    size_t ids[THREADS];
+
+    assert(tfs_init() != -1);
+
+    fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+
+    /* Each thread fills its own region of the file */
+    for (size_t i = 0; i < THREADS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, region_writer, &ids[i]) == 0);
+    }
+    for (size_t i = 0; i < THREADS; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+
+    /* Each thread checks its own region, all in parallel on the same
+       handle */
+    for (size_t i = 0; i < THREADS; i++) {
+        assert(pthread_create(&tid[i], NULL, region_reader, &ids[i]) == 0);
+    }
+    for (size_t i = 0; i < THREADS; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+
+    /* The positional calls never moved the handle's offset, so a plain
+       tfs_read starts from the beginning of the file */
+    char head[REGION_SIZE];
+    assert(tfs_read(fd, head, REGION_SIZE) == REGION_SIZE);
+    char expected[REGION_SIZE];
+    memset(expected, 'A', REGION_SIZE);
+    assert(memcmp(expected, head, REGION_SIZE) == 0);
+
+    assert(tfs_close(fd) != -1);
+
+    printf("Sucessful test\n");
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+#define BLOCKS 30
+#define SIZE 1024
+
+/**
+   This test reads a 30-block file front to back in block-sized calls (the
+   pattern that trains the readahead) and checks every byte, and then makes
+   sure a mapping change mid-stream -- a copy-on-write triggered by writing
+   a clone -- is never papered over by stale cached block numbers
+ */
+
+int main() {
+
+    char *path = "/f1";
+    char *clone = "/f2";
+
+    char input[SIZE];
+    char output [SIZE];
+
+    assert(tfs_init() != -1);
+
+    int fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+    for (int i = 0; i < BLOCKS; i++) {
+        memset(input, 'A' + (char)(i % 20), SIZE);
+        assert(tfs_write(fd, input, SIZE) == SIZE);
+    }
+    assert(tfs_close(fd) != -1);
+
+    /* A full sequential scan: after a couple of reads the rest comes
+       through the readahead cache */
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    for (int i = 0; i < BLOCKS; i++) {
+        memset(input, 'A' + (char)(i % 20), SIZE);
+        assert(tfs_read(fd, output, SIZE) == SIZE);
+        assert(memcmp(input, output, SIZE) == 0);
+    }
+    assert(tfs_read(fd, output, SIZE) == 0);
+    assert(tfs_close(fd) != -1);
+
+    /* Now scan a clone, and remap its blocks mid-stream: the clone's
+       writes copy shared blocks, so any cached numbers from before must
+       be dropped, not served */
+    assert(tfs_clone(path, clone) == 0);
+
+    fd = tfs_open(clone, 0);
+    assert(fd != -1);
+    for (int i = 0; i < 5; i++) {
+        memset(input, 'A' + (char)(i % 20), SIZE);
+        assert(tfs_read(fd, output, SIZE) == SIZE);
+        assert(memcmp(input, output, SIZE) == 0);
+    }
+
+    /* Rewrites blocks 5..9 of the clone through a second handle */
+    int wfd = tfs_open(clone, 0);
+    assert(wfd != -1);
+    memset(input, 'Z', SIZE);
+    for (int i = 5; i < 10; i++) {
+        assert(tfs_pwrite(wfd, input, SIZE, (size_t)i * SIZE) == SIZE);
+    }
+    assert(tfs_close(wfd) != -1);
+
+    /* The reader continues: it has to see the new contents */
+    for (int i = 5; i < 10; i++) {
+        assert(tfs_read(fd, output, SIZE) == SIZE);
+        assert(memcmp(input, output, SIZE) == 0);
+    }
+    for (int i = 10; i < BLOCKS; i++) {
+        memset(input, 'A' + (char)(i % 20), SIZE);
+        assert(tfs_read(fd, output, SIZE) == SIZE);
+        assert(memcmp(input, output, SIZE) == 0);
+    }
+    assert(tfs_close(fd) != -1);
+
+    printf("Sucessful test\n");
+
+    return 0;
+}
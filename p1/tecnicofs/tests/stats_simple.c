@@ -0,0 +1,80 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+#define COUNT 4
+#define SIZE 256
+
+/**
+   This test checks the statistics surface: operation counts and bytes
+   moved match what the test itself did, allocator occupancy reflects
+   the files created, and everything goes back to zero when the
+   filesystem is re-initialized
+ */
+
+int main() {
+
+    char *path = "/f1";
+
+    char input[SIZE];
+    memset(input, 'A', SIZE);
+
+    char output[SIZE];
+
+    assert(tfs_init() != -1);
+
+    tfs_stats stats;
+    assert(tfs_get_stats(&stats) == 0);
+    assert(stats.open_calls == 0);
+    assert(stats.bytes_written == 0);
+    assert(stats.inodes_used == 1); /* the root directory */
+    assert(stats.open_files_used == 0);
+
+    int fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+    for (int i = 0; i < COUNT; i++) {
+        assert(tfs_write(fd, input, SIZE) == SIZE);
+    }
+
+    assert(tfs_get_stats(&stats) == 0);
+    assert(stats.open_calls == 1);
+    assert(stats.write_calls == COUNT);
+    assert(stats.bytes_written == COUNT * SIZE);
+    assert(stats.inodes_used == 2);
+    assert(stats.data_blocks_used >= 1);
+    assert(stats.open_files_used == 1);
+    assert(stats.inodes_total > 0 && stats.data_blocks_total > 0 &&
+           stats.open_files_total > 0);
+
+    assert(tfs_close(fd) != -1);
+
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, output, SIZE) == SIZE);
+    assert(tfs_pread(fd, output, SIZE, 0) == SIZE);
+    assert(memcmp(input, output, SIZE) == 0);
+    assert(tfs_close(fd) != -1);
+
+    assert(tfs_get_stats(&stats) == 0);
+    assert(stats.open_calls == 2);
+    assert(stats.close_calls == 2);
+    assert(stats.read_calls == 2); /* tfs_pread counts as a read */
+    assert(stats.bytes_read == 2 * SIZE);
+    assert(stats.open_files_used == 0);
+
+    /* NULL is the only invalid argument */
+    assert(tfs_get_stats(NULL) == -1);
+
+    /* The statistics restart together with the filesystem */
+    assert(tfs_init() != -1);
+    assert(tfs_get_stats(&stats) == 0);
+    assert(stats.open_calls == 0);
+    assert(stats.bytes_read == 0);
+    assert(stats.inodes_used == 1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
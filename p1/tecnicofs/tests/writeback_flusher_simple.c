@@ -0,0 +1,70 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define COUNT 30
+#define SIZE 1024
+
+/**
+   This test runs the filesystem on an mmap'd store with the background
+   write-back flusher enabled, writes a file without ever calling
+   tfs_sync, gives the flusher a couple of intervals to run, and checks
+   that a restart from the same store still sees everything
+ */
+
+int main() {
+
+    char *path = "/f1";
+    char *store = "writeback_flusher_simple.store";
+
+    unlink(store);
+
+    tfs_params params = {
+        .block_size = 1024,
+        .data_blocks = 1024,
+        .inode_table_size = 50,
+        .max_open_files = 20,
+        .backing_file = store,
+        .flush_interval_ms = 20,
+    };
+
+    char input[SIZE];
+    memset(input, 'A', SIZE);
+
+    char output [SIZE];
+
+    assert(tfs_init_with_params(&params) != -1);
+
+    int fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+    for (int i = 0; i < COUNT; i++) {
+        assert(tfs_write(fd, input, SIZE) == SIZE);
+    }
+    assert(tfs_close(fd) != -1);
+
+    /* No tfs_sync here: the flusher is the one pushing the dirty blocks
+       out, so just let a few intervals go by */
+    struct timespec interval = {.tv_sec = 0, .tv_nsec = 100 * 1000 * 1000};
+    nanosleep(&interval, NULL);
+
+    assert(tfs_destroy() == 0);
+
+    /* Back up from the same store: the file has to be there */
+    assert(tfs_init_with_params(&params) != -1);
+
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    for (int i = 0; i < COUNT; i++) {
+        assert(tfs_read(fd, output, SIZE) == SIZE);
+        assert(memcmp(input, output, SIZE) == 0);
+    }
+    assert(tfs_close(fd) != -1);
+
+    unlink(store);
+
+    printf("Sucessful test\n");
+
+    return 0;
+}
@@ -1,6 +1,7 @@
 #include "tecnicofs_client_api.h"
 
 #include <stdio.h>
+#include <sys/mman.h>
 
 /* Global variables used to store both the server and clients's file descriptors */
 static int client_fd;
@@ -13,56 +14,320 @@ static int curr_session_id;
 /* Stores the current client's pipe path name (for later unlink) */
 static char curr_client_pipe_path[MAX_CPATH_LEN];
 
+/* The session's private request pipe: every request after the mount goes
+ * down this pipe, which only the server's receiver for this session
+ * reads, so no other client's traffic can get in front of ours */
+static int request_fd;
+static char curr_request_pipe_path[MAX_CPATH_LEN];
+
+/* Shared-memory transport of the session, when the mount managed to
+ * negotiate one (the pipes are the fallback): requests go into the
+ * channel's request ring and replies come off its reply ring */
+static int use_shm;
+static shm_channel_t *channel;
+
+/* Stores the shm segment's name (for later unlink) */
+static char curr_shm_name[MAX_CPATH_LEN];
+
+
+/*
+ * Sends one request frame to the server, over whichever transport the
+ * session uses
+ * Inputs:
+ *  - source of the request (op code included)
+ *  - size of the request
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int send_request(void const *source, size_t size) {
+    if (use_shm) {
+        return shm_ring_write_framed(&channel->request_ring, source, size);
+    }
+    return write_framed(request_fd, source, size);
+}
 
-int tfs_mount(char const *client_pipe_path, char const *server_pipe_path) {
-    size_t buffer_size = OP_CODE_SIZE + MAX_CPATH_LEN;
+
+/*
+ * Reads part of the server's reply, over whichever transport the session
+ * uses
+ * Inputs:
+ *  - destination of the content read
+ *  - size of the content
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int recv_reply(void *destination, size_t size) {
+    if (use_shm) {
+        return shm_ring_read(&channel->reply_ring, destination, size);
+    }
+    return read_until_success(client_fd, destination, size);
+}
+
+
+/* Completion table for pipelined operations: each slot holds one
+ * in-flight (or completed but not yet collected) request submitted by
+ * tfs_write_async(). The transport delivers replies in submission order
+ * (the session's worker is single-threaded), so each reply pulled off
+ * the stream belongs to the oldest outstanding slot; the sequence
+ * numbers record that submission order */
+typedef struct {
+    int in_use;
+    int done;
+    unsigned long seq;
+    ssize_t ret;
+} async_op_t;
+
+static async_op_t async_ops[TFS_ASYNC_MAX];
+static unsigned long async_next_seq;
+
+/* Only one thread at a time may pull a reply off the transport */
+static int async_reader_busy;
+
+static pthread_mutex_t async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_cond = PTHREAD_COND_INITIALIZER;
+
+
+/*
+ * Makes one unit of progress towards completing outstanding operations,
+ * with async_mutex held: either waits for the thread currently reading a
+ * reply, or becomes that thread and completes the oldest outstanding
+ * slot. Callers loop on their own condition around this.
+ * Returns: 0 if successful, -1 otherwise (including nothing outstanding)
+ */
+static int async_progress(void) {
+    if (async_reader_busy) {
+        /* Another thread is on the transport: its completion (or the
+         * slot it frees) will be broadcast */
+        return (pthread_cond_wait(&async_cond, &async_mutex) == 0) ? 0 : -1;
+    }
+
+    int oldest = -1;
+    for (int i = 0; i < TFS_ASYNC_MAX; i++) {
+        if (async_ops[i].in_use && !async_ops[i].done &&
+            (oldest == -1 || async_ops[i].seq < async_ops[oldest].seq)) {
+            oldest = i;
+        }
+    }
+    if (oldest == -1) {
+        return -1;
+    }
+
+    /* The transport read happens outside the lock, so new submissions
+     * and waiters aren't blocked behind it */
+    async_reader_busy = 1;
+    pthread_mutex_unlock(&async_mutex);
+
+    ssize_t ret;
+    int rc = recv_reply(&ret, RDWR_VAL_SIZE);
+
+    pthread_mutex_lock(&async_mutex);
+    async_reader_busy = 0;
+
+    async_ops[oldest].ret = (rc == 0) ? ret : -1;
+    async_ops[oldest].done = 1;
+
+    pthread_cond_broadcast(&async_cond);
+
+    return 0;
+}
+
+
+/*
+ * Completes every outstanding pipelined operation (their results stay in
+ * the table for tfs_wait to collect), so the reply stream is empty:
+ * called before any synchronous request, whose reply would otherwise get
+ * mixed up with the pipelined ones.
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int async_drain(void) {
+    if (pthread_mutex_lock(&async_mutex) != 0) {
+        return -1;
+    }
+
+    while (1) {
+        int outstanding = 0;
+        for (int i = 0; i < TFS_ASYNC_MAX; i++) {
+            if (async_ops[i].in_use && !async_ops[i].done) {
+                outstanding = 1;
+                break;
+            }
+        }
+        if (!outstanding) {
+            break;
+        }
+
+        if (async_progress() != 0) {
+            pthread_mutex_unlock(&async_mutex);
+            return -1;
+        }
+    }
+
+    return (pthread_mutex_unlock(&async_mutex) == 0) ? 0 : -1;
+}
+
+
+/*
+ * Tries to mount over shared memory: creates and initializes a shm
+ * segment holding the session's channel (named after the client pipe's
+ * last path component, so concurrent clients don't collide), sends its
+ * name to the server over the server's pipe, and waits for the session
+ * id on the reply ring. On any failure everything is torn down and the
+ * caller falls back to the pipe transport.
+ * Inputs:
+ *  - client pipe's path name (only used to derive the segment's name)
+ *  - server pipe's path name
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int tfs_mount_over_shm(char const *client_pipe_path,
+                              char const *server_pipe_path) {
+    /* "/tmp/client_pipe" becomes the segment name "/client_pipe" */
+    char const *base = strrchr(client_pipe_path, '/');
+    base = (base != NULL) ? base + 1 : client_pipe_path;
+
+    char shm_name[MAX_CPATH_LEN] = {0};
+    shm_name[0] = '/';
+    strncpy(shm_name + 1, base, MAX_CPATH_LEN - 2);
+
+    shm_unlink(shm_name);
+
+    int shm_fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0777);
+    if (shm_fd == -1) {
+        return -1;
+    }
+
+    if (ftruncate(shm_fd, sizeof(shm_channel_t)) != 0) {
+        close_until_success(shm_fd);
+        shm_unlink(shm_name);
+        return -1;
+    }
+
+    channel = mmap(NULL, sizeof(shm_channel_t), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, shm_fd, 0);
+    close_until_success(shm_fd);
+    if (channel == MAP_FAILED) {
+        shm_unlink(shm_name);
+        return -1;
+    }
+
+    if (shm_channel_init(channel) != 0) {
+        munmap(channel, sizeof(shm_channel_t));
+        shm_unlink(shm_name);
+        return -1;
+    }
+
+    /* The mount itself still travels over the server's pipe; everything
+     * after it goes through the channel */
+    server_fd = open_until_success(server_pipe_path, O_WRONLY);
+    if (server_fd == -1) {
+        munmap(channel, sizeof(shm_channel_t));
+        shm_unlink(shm_name);
+        return -1;
+    }
+
+    char buffer[OP_CODE_SIZE + MAX_CPATH_LEN];
+    buffer[0] = (char) TFS_OP_CODE_MOUNT_SHM;
+    memcpy(buffer + OP_CODE_SIZE, shm_name, MAX_CPATH_LEN);
+
+    if (write_framed(server_fd, buffer, sizeof(buffer)) != 0 ||
+        shm_ring_read(&channel->reply_ring, &curr_session_id,
+                      SESSION_ID_SIZE) != 0 ||
+        curr_session_id == -1) {
+        close_until_success(server_fd);
+        munmap(channel, sizeof(shm_channel_t));
+        shm_unlink(shm_name);
+        return -1;
+    }
+
+    strncpy(curr_shm_name, shm_name, MAX_CPATH_LEN - 1);
+    curr_shm_name[MAX_CPATH_LEN - 1] = 0;
+    use_shm = 1;
+
+    return 0;
+}
+
+
+int tfs_mount_pipes(char const *client_pipe_path, char const *server_pipe_path) {
+    /* A new session starts with no pipelined operations in flight */
+    memset(async_ops, 0, sizeof(async_ops));
+    async_next_seq = 0;
+    async_reader_busy = 0;
+    use_shm = 0;
+
+    /* The session's request pipe is named after the reply pipe */
+    char request_pipe_path[MAX_CPATH_LEN];
+    if (snprintf(request_pipe_path, MAX_CPATH_LEN, "%.*s_r",
+                 MAX_CPATH_LEN - 3, client_pipe_path) < 0) {
+        return -1;
+    }
+
+    size_t buffer_size = OP_CODE_SIZE + MAX_CPATH_LEN + MAX_CPATH_LEN;
 
     /* Buffer used to send mount commands to the server:
      * - Structure:
-     *   OP_CODE | <client pipe path name> */
+     *   OP_CODE | <client pipe path name> | <request pipe path name> */
     char buffer[buffer_size];
 
     buffer[0] = (char) TFS_OP_CODE_MOUNT;
     memcpy(buffer + OP_CODE_SIZE, client_pipe_path, MAX_CPATH_LEN);
+    memcpy(buffer + OP_CODE_SIZE + MAX_CPATH_LEN, request_pipe_path,
+           MAX_CPATH_LEN);
 
     unlink(client_pipe_path);
+    unlink(request_pipe_path);
 
-    if (mkfifo(client_pipe_path, 0777) != 0) {
+    if (mkfifo(client_pipe_path, 0777) != 0 ||
+        mkfifo(request_pipe_path, 0777) != 0) {
+        unlink(client_pipe_path);
         return -1;
     }
-    
-    printf("write client\n");
-    /* Opens the server's pipe for every future writing */
+
+    /* Stores both pipes' path names (for later unlink) */
+    strncpy(curr_client_pipe_path, client_pipe_path, MAX_CPATH_LEN - 1);
+    curr_client_pipe_path[MAX_CPATH_LEN - 1] = 0;
+    strncpy(curr_request_pipe_path, request_pipe_path, MAX_CPATH_LEN - 1);
+    curr_request_pipe_path[MAX_CPATH_LEN - 1] = 0;
+
+    /* The server's pipe only carries the mount itself */
     server_fd = open_until_success(server_pipe_path, O_WRONLY);
     if (server_fd == -1) {
         unlink(client_pipe_path);
+        unlink(request_pipe_path);
         return -1;
     }
 
-    if (write_until_success(server_fd, buffer, buffer_size) != 0) {
+    if (write_framed(server_fd, buffer, buffer_size) != 0) {
         close_until_success(server_fd);
         unlink(client_pipe_path);
+        unlink(request_pipe_path);
         return -1;
     }
 
-    printf("read client\n");
     /* Opens the client's pipe for every future reading (in the same session) */
     client_fd = open_until_success(client_pipe_path, O_RDONLY);
     if (client_fd == -1) {
         close_until_success(server_fd);
         unlink(client_pipe_path);
+        unlink(request_pipe_path);
         return -1;
     }
 
-    if (read_until_success(client_fd, &curr_session_id, SESSION_ID_SIZE) != 0) {
+    /* Opens the session's request pipe for every future request (the
+     * server opens its reading end right after our reply pipe) */
+    request_fd = open_until_success(request_pipe_path, O_WRONLY);
+    if (request_fd == -1) {
         close_until_success(server_fd);
         close_until_success(client_fd);
         unlink(client_pipe_path);
-        printf("joao5\n");
+        unlink(request_pipe_path);
         return -1;
     }
 
-    printf("%d\n", curr_session_id);
+    if (read_until_success(client_fd, &curr_session_id, SESSION_ID_SIZE) != 0) {
+        close_until_success(server_fd);
+        close_until_success(client_fd);
+        close_until_success(request_fd);
+        unlink(client_pipe_path);
+        unlink(request_pipe_path);
+        return -1;
+    }
 
     /* In case the server sent a -1 to the client, an error ocurred on the
      * server's side, and so, we return error */
@@ -73,7 +338,29 @@ int tfs_mount(char const *client_pipe_path, char const *server_pipe_path) {
     return 0;
 }
 
+
+int tfs_mount(char const *client_pipe_path, char const *server_pipe_path) {
+    /* A new session starts with no pipelined operations in flight */
+    memset(async_ops, 0, sizeof(async_ops));
+    async_next_seq = 0;
+    async_reader_busy = 0;
+
+    /* Shared memory is the preferred transport; if it can't be set up
+     * the session runs over the pipes */
+    if (tfs_mount_over_shm(client_pipe_path, server_pipe_path) == 0) {
+        return 0;
+    }
+
+    return tfs_mount_pipes(client_pipe_path, server_pipe_path);
+}
+
 int tfs_unmount() {
+    /* Pipelined operations still in flight complete first, so their
+     * replies don't get mistaken for this one's */
+    if (async_drain() != 0) {
+        return -1;
+    }
+
     size_t buffer_size = OP_CODE_SIZE + SESSION_ID_SIZE;
 
     /* Buffer used to send unmount commands to the server:
@@ -84,13 +371,12 @@ int tfs_unmount() {
     buffer[0] = (char) TFS_OP_CODE_UNMOUNT;
     memcpy(buffer + OP_CODE_SIZE, &curr_session_id, SESSION_ID_SIZE);
 
-    if (write_until_success(server_fd, buffer, buffer_size) != 0) {
+    if (send_request(buffer, buffer_size) != 0) {
         return -1;
     }
     
-    /* Stores the client's pipe path name, sent by the server to the client */
     int ret;
-    if (read_until_success(client_fd, &ret, RETURN_VAL_SIZE) != 0) {
+    if (recv_reply(&ret, RETURN_VAL_SIZE) != 0) {
         return -1;
     }
 
@@ -100,6 +386,27 @@ int tfs_unmount() {
         return -1;
     }
 
+    if (use_shm) {
+        /* Closing the channel is what tells the server's receiver thread
+         * the session is gone */
+        shm_channel_close(channel);
+        munmap(channel, sizeof(shm_channel_t));
+        shm_unlink(curr_shm_name);
+        use_shm = 0;
+
+        return close_until_success(server_fd);
+    }
+
+    /* Closing the request pipe is what tells the server's receiver
+     * thread the session is gone */
+    if (close_until_success(request_fd) != 0) {
+        return -1;
+    }
+
+    if (unlink(curr_request_pipe_path) != 0) {
+        return -1;
+    }
+
     /* Closes the client's pipe */
     if (close_until_success(client_fd) != 0) {
         return -1;
@@ -120,6 +427,12 @@ int tfs_unmount() {
 
 
 int tfs_open(char const *name, int flags) {
+    /* Pipelined operations still in flight complete first, so their
+     * replies don't get mistaken for this one's */
+    if (async_drain() != 0) {
+        return -1;
+    }
+
     /* Size of the buffer used. Since "name" has a maximum size of 40 we use the same
      * macro as the one used for the client_pipe_path length */
     size_t buffer_size = OP_CODE_SIZE + SESSION_ID_SIZE + MAX_CPATH_LEN + FLAG_SIZE;
@@ -134,26 +447,28 @@ int tfs_open(char const *name, int flags) {
     memcpy(buffer + OP_CODE_SIZE + SESSION_ID_SIZE, name, MAX_CPATH_LEN);
     memcpy(buffer + OP_CODE_SIZE + SESSION_ID_SIZE + MAX_CPATH_LEN, &flags, FLAG_SIZE);
 
-    if (write_until_success(server_fd, buffer, buffer_size) != 0) {
-        return -1;
-    }
-    
-    int ret;
-    if (read_until_success(client_fd, &ret, RETURN_VAL_SIZE) != 0) {
+    if (send_request(buffer, buffer_size) != 0) {
         return -1;
     }
 
-    /* In case the server sent a -1 to the client, an error ocurred on the
-     * server's side, and so, we return error */
-    if (ret == -1) {
+    int ret;
+    if (recv_reply(&ret, RETURN_VAL_SIZE) != 0) {
         return -1;
     }
 
-    return 0;
+    /* The server's return value is the file handle itself (-1 meaning an
+     * error ocurred on the server's side) */
+    return ret;
 }
 
 
 int tfs_close(int fhandle) {
+    /* Pipelined operations still in flight complete first, so their
+     * replies don't get mistaken for this one's */
+    if (async_drain() != 0) {
+        return -1;
+    }
+
     size_t buffer_size = OP_CODE_SIZE + SESSION_ID_SIZE + FHANDLE_SIZE;
 
     /* Buffer used to send close commands to the server
@@ -161,16 +476,16 @@ int tfs_close(int fhandle) {
      *   OP_CODE | session_id | fhandle */
     char buffer[buffer_size];
 
-    buffer[0] = (char) TFS_OP_CODE_OPEN;
+    buffer[0] = (char) TFS_OP_CODE_CLOSE;
     memcpy(buffer + OP_CODE_SIZE, &curr_session_id, SESSION_ID_SIZE);
     memcpy(buffer + OP_CODE_SIZE + SESSION_ID_SIZE, &fhandle, FHANDLE_SIZE);
 
-    if (write_until_success(server_fd, buffer, buffer_size) != 0) {
+    if (send_request(buffer, buffer_size) != 0) {
         return -1;
     }
     
     int ret;
-    if (read_until_success(client_fd, &ret, RETURN_VAL_SIZE) != 0) {
+    if (recv_reply(&ret, RETURN_VAL_SIZE) != 0) {
         return -1;
     }
 
@@ -185,73 +500,433 @@ int tfs_close(int fhandle) {
 
 
 ssize_t tfs_write(int fhandle, void const *buffer, size_t len) {
-    /* Size of the buffer used (MAX_RDWR_SIZE comes from the size of a block) */
-    size_t buffer_size = OP_CODE_SIZE + SESSION_ID_SIZE + FHANDLE_SIZE + LEN_SIZE + MAX_RDWR_SIZE;
+    /* Pipelined operations still in flight complete first, so their
+     * replies don't get mistaken for this one's */
+    if (async_drain() != 0) {
+        return -1;
+    }
+
+    /* Requests up to one block carry their data inline; bigger ones only
+     * declare the total length here and stream the data right after */
+    size_t inline_len = (len <= MAX_RDWR_SIZE) ? len : 0;
+
+    size_t buffer_size = OP_CODE_SIZE + SESSION_ID_SIZE + FHANDLE_SIZE + LEN_SIZE + inline_len;
 
     /* Buffer used to send write commands to the server
      * - Structure:
      *   OP_CODE | session_id | fhandle | len | <buffer's content> */
     char write_buffer[buffer_size];
 
-    write_buffer[0] = (char) TFS_OP_CODE_OPEN;
+    write_buffer[0] = (char) TFS_OP_CODE_WRITE;
     memcpy(write_buffer + OP_CODE_SIZE, &curr_session_id, SESSION_ID_SIZE);
     memcpy(write_buffer + OP_CODE_SIZE + SESSION_ID_SIZE, &fhandle, FHANDLE_SIZE);
     memcpy(write_buffer + OP_CODE_SIZE + SESSION_ID_SIZE + FHANDLE_SIZE, &len, LEN_SIZE);
-    memcpy(write_buffer + OP_CODE_SIZE + SESSION_ID_SIZE + FHANDLE_SIZE + LEN_SIZE, buffer, len);
+    if (inline_len > 0) {
+        memcpy(write_buffer + OP_CODE_SIZE + SESSION_ID_SIZE + FHANDLE_SIZE + LEN_SIZE,
+               buffer, inline_len);
+    }
 
-    if (write_until_success(server_fd, write_buffer, buffer_size) != 0) {
+    if (send_request(write_buffer, buffer_size) != 0) {
         return -1;
     }
-    
-    ssize_t ret;
-    if (read_until_success(client_fd, &ret, RDWR_VAL_SIZE) != 0) {
-        return -1;
+
+    if (len > MAX_RDWR_SIZE) {
+        /* Streaming mode: the data flows in back-to-back DATA frames with
+         * no per-chunk acknowledgment; the single status reply below
+         * covers the whole transfer
+         * - Chunk structure:
+         *   OP_CODE | session_id | chunk_len | <chunk's content> */
+        char data_frame[OP_CODE_SIZE + SESSION_ID_SIZE + LEN_SIZE + MAX_RDWR_SIZE];
+
+        data_frame[0] = (char) TFS_OP_CODE_DATA;
+        memcpy(data_frame + OP_CODE_SIZE, &curr_session_id, SESSION_ID_SIZE);
+
+        size_t sent = 0;
+        while (sent < len) {
+            size_t chunk = len - sent;
+            if (chunk > MAX_RDWR_SIZE) {
+                chunk = MAX_RDWR_SIZE;
+            }
+
+            memcpy(data_frame + OP_CODE_SIZE + SESSION_ID_SIZE, &chunk, LEN_SIZE);
+            memcpy(data_frame + OP_CODE_SIZE + SESSION_ID_SIZE + LEN_SIZE,
+                   buffer + sent, chunk);
+
+            if (send_request(data_frame,
+                             OP_CODE_SIZE + SESSION_ID_SIZE + LEN_SIZE + chunk) != 0) {
+                return -1;
+            }
+
+            sent += chunk;
+        }
     }
 
-    /* In case the server sent a -1 to the client, an error ocurred on the
-     * server's side, and so, we return error */
-    if (ret == -1) {
+    ssize_t ret;
+    if (recv_reply(&ret, RDWR_VAL_SIZE) != 0) {
         return -1;
     }
 
-    return 0;
+    /* The server's return value is the number of bytes written (-1
+     * meaning an error ocurred on the server's side) */
+    return ret;
 }
 
 
 ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
-    size_t buffer_size = OP_CODE_SIZE + SESSION_ID_SIZE + FHANDLE_SIZE + LEN_SIZE + MAX_RDWR_SIZE;
+    /* Pipelined operations still in flight complete first, so their
+     * replies don't get mistaken for this one's */
+    if (async_drain() != 0) {
+        return -1;
+    }
+
+    /* Only the request's header travels: the data comes back in the
+     * reply, there is no point in shipping the (empty) buffer over */
+    size_t buffer_size = OP_CODE_SIZE + SESSION_ID_SIZE + FHANDLE_SIZE + LEN_SIZE;
 
     /* Buffer used to send read commands to the server
      * - Structure:
-     *   OP_CODE | session_id | fhandle | len | <buffer itself used to store the data read> */
+     *   OP_CODE | session_id | fhandle | len */
     char read_buffer[buffer_size];
 
-    read_buffer[0] = (char) TFS_OP_CODE_OPEN;
+    read_buffer[0] = (char) TFS_OP_CODE_READ;
     memcpy(read_buffer + OP_CODE_SIZE, &curr_session_id, SESSION_ID_SIZE);
     memcpy(read_buffer + OP_CODE_SIZE + SESSION_ID_SIZE, &fhandle, FHANDLE_SIZE);
     memcpy(read_buffer + OP_CODE_SIZE + SESSION_ID_SIZE + FHANDLE_SIZE, &len, LEN_SIZE);
-    memcpy(read_buffer + OP_CODE_SIZE + SESSION_ID_SIZE + FHANDLE_SIZE + LEN_SIZE, buffer, len);
 
-    if (write_until_success(server_fd, read_buffer, buffer_size) != 0) {
+    if (send_request(read_buffer, buffer_size) != 0) {
         return -1;
     }
-    
+
+    /* The reply arrives as back-to-back chunks of at most MAX_RDWR_SIZE,
+     * each a byte count followed by that many data bytes, with no
+     * acknowledgment in between; a short chunk means the file's end was
+     * reached. For a request of up to one block this is a single chunk,
+     * just like before. The server replies even to a zero-length read
+     * (one empty chunk), so at least one count is always consumed here --
+     * skipping it would leave that count in the pipe and shift every
+     * later reply by one frame */
+    ssize_t total = 0;
+    do {
+        size_t want = len - (size_t)total;
+        if (want > MAX_RDWR_SIZE) {
+            want = MAX_RDWR_SIZE;
+        }
+
+        ssize_t ret;
+        if (recv_reply(&ret, RDWR_VAL_SIZE) != 0) {
+            return -1;
+        }
+
+        if (ret == -1) {
+            /* An error ocurred on the server's side: if some data already
+             * arrived we return it, otherwise we return the error */
+            return (total > 0) ? total : -1;
+        }
+
+        if (ret > 0) {
+            if (recv_reply(buffer + total, (size_t)ret) != 0) {
+                return -1;
+            }
+            total += ret;
+        }
+
+        if ((size_t)ret < want) {
+            /* Short chunk: nothing left to read */
+            break;
+        }
+    } while ((size_t)total < len);
+
+    return total;
+}
+
+
+ssize_t tfs_client_put(char const *name, void const *buffer, size_t len) {
+    /* Pipelined operations still in flight complete first, so their
+     * replies don't get mistaken for this one's */
+    if (async_drain() != 0) {
+        return -1;
+    }
+
+    /* One block is all a file can hold anyway */
+    if (len > MAX_RDWR_SIZE) {
+        len = MAX_RDWR_SIZE;
+    }
+
+    /* The file name travels in a fixed-size, zero-padded field, like in
+     * tfs_open */
+    char file_name[MAX_CPATH_LEN] = {0};
+    strncpy(file_name, name, MAX_CPATH_LEN - 1);
+
+    size_t buffer_size =
+        OP_CODE_SIZE + SESSION_ID_SIZE + MAX_CPATH_LEN + LEN_SIZE + len;
+
+    /* Buffer used to send compound put commands to the server
+     * - Structure:
+     *   OP_CODE | session_id | <file name> | len | data */
+    char request[buffer_size];
+
+    request[0] = (char) TFS_OP_CODE_OPEN_WRITE_CLOSE;
+    memcpy(request + OP_CODE_SIZE, &curr_session_id, SESSION_ID_SIZE);
+    memcpy(request + OP_CODE_SIZE + SESSION_ID_SIZE, file_name,
+           MAX_CPATH_LEN);
+    memcpy(request + OP_CODE_SIZE + SESSION_ID_SIZE + MAX_CPATH_LEN, &len,
+           LEN_SIZE);
+    memcpy(request + OP_CODE_SIZE + SESSION_ID_SIZE + MAX_CPATH_LEN +
+           LEN_SIZE, buffer, len);
+
+    if (send_request(request, buffer_size) != 0) {
+        return -1;
+    }
+
+    /* A single reply carries the number of bytes written */
     ssize_t ret;
-    if (read_until_success(client_fd, &ret, RDWR_VAL_SIZE) != 0) {
+    if (recv_reply(&ret, RDWR_VAL_SIZE) != 0) {
         return -1;
     }
 
-    /* In case the server sent a -1 to the client, an error ocurred on the
-     * server's side, and so, we return error */
-    if (ret == -1) {
+    return ret;
+}
+
+ssize_t tfs_client_get(char const *name, void *buffer, size_t len) {
+    /* Pipelined operations still in flight complete first, so their
+     * replies don't get mistaken for this one's */
+    if (async_drain() != 0) {
+        return -1;
+    }
+
+    char file_name[MAX_CPATH_LEN] = {0};
+    strncpy(file_name, name, MAX_CPATH_LEN - 1);
+
+    size_t buffer_size =
+        OP_CODE_SIZE + SESSION_ID_SIZE + MAX_CPATH_LEN + LEN_SIZE;
+
+    /* Buffer used to send compound get commands to the server
+     * - Structure:
+     *   OP_CODE | session_id | <file name> | len */
+    char request[buffer_size];
+
+    request[0] = (char) TFS_OP_CODE_OPEN_READ_CLOSE;
+    memcpy(request + OP_CODE_SIZE, &curr_session_id, SESSION_ID_SIZE);
+    memcpy(request + OP_CODE_SIZE + SESSION_ID_SIZE, file_name,
+           MAX_CPATH_LEN);
+    memcpy(request + OP_CODE_SIZE + SESSION_ID_SIZE + MAX_CPATH_LEN, &len,
+           LEN_SIZE);
+
+    if (send_request(request, buffer_size) != 0) {
+        return -1;
+    }
+
+    /* The reply is a single chunk: the byte count, then the data */
+    ssize_t ret;
+    if (recv_reply(&ret, RDWR_VAL_SIZE) != 0) {
+        return -1;
+    }
+
+    if (ret <= 0) {
+        return ret;
+    }
+
+    if (recv_reply(buffer, (size_t)ret) != 0) {
+        return -1;
+    }
+
+    return ret;
+}
+
+int tfs_client_stats(tfs_stats *stats) {
+    if (stats == NULL) {
+        return -1;
+    }
+
+    /* Pipelined operations still in flight complete first, so their
+     * replies don't get mistaken for this one's */
+    if (async_drain() != 0) {
+        return -1;
+    }
+
+    size_t buffer_size = OP_CODE_SIZE + SESSION_ID_SIZE;
+
+    /* Buffer used to send stats commands to the server
+     * - Structure:
+     *   OP_CODE | session_id */
+    char buffer[buffer_size];
+
+    buffer[0] = (char) TFS_OP_CODE_STATS;
+    memcpy(buffer + OP_CODE_SIZE, &curr_session_id, SESSION_ID_SIZE);
+
+    if (send_request(buffer, buffer_size) != 0) {
+        return -1;
+    }
+
+    /* The reply is the server's whole tfs_stats struct */
+    if (recv_reply(stats, sizeof(tfs_stats)) != 0) {
         return -1;
     }
 
     return 0;
 }
 
+int tfs_write_async(int fhandle, void const *buffer, size_t len) {
+    /* One block is all a file can hold anyway, and capping the length
+     * keeps every pipelined operation at exactly one reply */
+    if (len > MAX_RDWR_SIZE) {
+        len = MAX_RDWR_SIZE;
+    }
+
+    if (pthread_mutex_lock(&async_mutex) != 0) {
+        return -1;
+    }
+
+    int slot;
+    while (1) {
+        slot = -1;
+        int outstanding = 0;
+        for (int i = 0; i < TFS_ASYNC_MAX; i++) {
+            if (!async_ops[i].in_use) {
+                slot = i;
+            } else if (!async_ops[i].done) {
+                outstanding = 1;
+            }
+        }
+        if (slot != -1) {
+            break;
+        }
+        if (!outstanding) {
+            /* Every slot holds a completion nobody collected yet: there
+             * is nothing to wait for, the caller has to tfs_wait first */
+            pthread_mutex_unlock(&async_mutex);
+            return -1;
+        }
+        if (async_progress() != 0) {
+            pthread_mutex_unlock(&async_mutex);
+            return -1;
+        }
+    }
+
+    async_ops[slot].in_use = 1;
+    async_ops[slot].done = 0;
+    async_ops[slot].seq = async_next_seq++;
+
+    /* The request goes out while the lock is held, so the submission
+     * order (and with it the reply order) matches the sequence numbers */
+    size_t buffer_size = OP_CODE_SIZE + SESSION_ID_SIZE + FHANDLE_SIZE + LEN_SIZE + len;
+
+    /* Same structure as a synchronous write:
+     *   OP_CODE | session_id | fhandle | len | <buffer's content> */
+    char write_buffer[buffer_size];
+
+    write_buffer[0] = (char) TFS_OP_CODE_WRITE;
+    memcpy(write_buffer + OP_CODE_SIZE, &curr_session_id, SESSION_ID_SIZE);
+    memcpy(write_buffer + OP_CODE_SIZE + SESSION_ID_SIZE, &fhandle, FHANDLE_SIZE);
+    memcpy(write_buffer + OP_CODE_SIZE + SESSION_ID_SIZE + FHANDLE_SIZE, &len, LEN_SIZE);
+    memcpy(write_buffer + OP_CODE_SIZE + SESSION_ID_SIZE + FHANDLE_SIZE + LEN_SIZE,
+           buffer, len);
+
+    if (send_request(write_buffer, buffer_size) != 0) {
+        async_ops[slot].in_use = 0;
+        pthread_mutex_unlock(&async_mutex);
+        return -1;
+    }
+
+    if (pthread_mutex_unlock(&async_mutex) != 0) {
+        return -1;
+    }
+
+    return slot;
+}
+
+
+ssize_t tfs_wait(int handle) {
+    if (handle < 0 || handle >= TFS_ASYNC_MAX) {
+        return -1;
+    }
+
+    if (pthread_mutex_lock(&async_mutex) != 0) {
+        return -1;
+    }
+
+    if (!async_ops[handle].in_use) {
+        pthread_mutex_unlock(&async_mutex);
+        return -1;
+    }
+
+    while (!async_ops[handle].done) {
+        if (async_progress() != 0) {
+            pthread_mutex_unlock(&async_mutex);
+            return -1;
+        }
+    }
+
+    ssize_t ret = async_ops[handle].ret;
+    async_ops[handle].in_use = 0;
+
+    /* A submitter might be waiting for a free slot */
+    pthread_cond_broadcast(&async_cond);
+
+    if (pthread_mutex_unlock(&async_mutex) != 0) {
+        return -1;
+    }
+
+    return ret;
+}
+
+
+int tfs_wait_any(ssize_t *result) {
+    if (pthread_mutex_lock(&async_mutex) != 0) {
+        return -1;
+    }
+
+    int handle;
+    while (1) {
+        handle = -1;
+        int in_flight = 0;
+        for (int i = 0; i < TFS_ASYNC_MAX; i++) {
+            if (!async_ops[i].in_use) {
+                continue;
+            }
+            if (async_ops[i].done) {
+                /* The oldest completion goes first, like the replies did */
+                if (handle == -1 || async_ops[i].seq < async_ops[handle].seq) {
+                    handle = i;
+                }
+            } else {
+                in_flight = 1;
+            }
+        }
+        if (handle != -1) {
+            break;
+        }
+        if (!in_flight) {
+            /* Nothing submitted at all */
+            pthread_mutex_unlock(&async_mutex);
+            return -1;
+        }
+        if (async_progress() != 0) {
+            pthread_mutex_unlock(&async_mutex);
+            return -1;
+        }
+    }
+
+    *result = async_ops[handle].ret;
+    async_ops[handle].in_use = 0;
+
+    pthread_cond_broadcast(&async_cond);
+
+    if (pthread_mutex_unlock(&async_mutex) != 0) {
+        return -1;
+    }
+
+    return handle;
+}
+
 
 int tfs_shutdown_after_all_closed() {
+    /* Pipelined operations still in flight complete first, so their
+     * replies don't get mistaken for this one's */
+    if (async_drain() != 0) {
+        return -1;
+    }
+
     size_t buffer_size = OP_CODE_SIZE + SESSION_ID_SIZE;
 
     /* Buffer used to send shutdown_after_all_closed commands to the server
@@ -259,18 +934,17 @@ int tfs_shutdown_after_all_closed() {
      *   OP_CODE | session_id */
     char buffer[buffer_size];
 
-    buffer[0] = (char) TFS_OP_CODE_OPEN;
+    buffer[0] = (char) TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED;
     memcpy(buffer + OP_CODE_SIZE, &curr_session_id, SESSION_ID_SIZE);
 
-    if (write_until_success(server_fd, buffer, buffer_size) != 0) {
+    if (send_request(buffer, buffer_size) != 0) {
         return -1;
     }
-    
+
     int ret;
-    if (read_until_success(client_fd, &ret, RETURN_VAL_SIZE) != 0) {
+    if (recv_reply(&ret, RETURN_VAL_SIZE) != 0) {
         return -1;
     }
 
-    /* TODO: exit? */
-    exit(1);
+    return ret;
 }
@@ -4,6 +4,10 @@
 #include "common/common.h"
 #include <sys/types.h>
 
+/* Maximum number of pipelined operations in flight (or completed but
+ * not yet collected) at a time */
+#define TFS_ASYNC_MAX (8)
+
 
 /*
  * Establishes a session with a TecnicoFS server.
@@ -22,6 +26,18 @@
  */
 int tfs_mount(char const *client_pipe_path, char const *server_pipe_path);
 
+/*
+ * Like tfs_mount, but forces the pipe transport (tfs_mount prefers
+ * shared memory and only falls back to the pipes when the shm channel
+ * can't be set up). Besides the reply pipe above, the mount creates a
+ * private request pipe for the session (named after the reply pipe,
+ * with a "_r" suffix), which carries every request after the mount so
+ * the server reads each session independently.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_mount_pipes(char const *client_pipe_path, char const *server_pipe_path);
+
 /*
  * Ends the currently active session.
  * After notifying the server, both named pipes are closed by the client,
@@ -73,6 +89,76 @@ ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
  */
 ssize_t tfs_read(int fhandle, void *buffer, size_t len);
 
+/* Writes a whole file in one round trip: the server runs the equivalent
+ * of open(TFS_O_CREAT | TFS_O_TRUNC) + write + close in a single
+ * dispatch, so the usual three request/reply exchanges collapse into one.
+ * Input:
+ * 	- name: absolute path name
+ * 	- buffer containing the contents to write
+ * 	- length of the contents (in bytes, at most one block)
+ *
+ * Returns the number of bytes that were written, or -1 in case of error.
+ */
+ssize_t tfs_client_put(char const *name, void const *buffer, size_t len);
+
+/* Reads a whole file in one round trip: the server runs the equivalent
+ * of open + read + close in a single dispatch.
+ * Input:
+ * 	- name: absolute path name
+ * 	- destination buffer
+ * 	- length of the buffer (at most one block is returned)
+ *
+ * Returns the number of bytes that were copied from the file to the
+ * buffer, or -1 in case of error.
+ */
+ssize_t tfs_client_get(char const *name, void *buffer, size_t len);
+
+/* Fetches the server's statistics (see the tfs_stats struct in
+ * common/common.h) in one round trip: operation counts and bytes moved
+ * since the server started, table occupancy and cumulative lock-wait
+ * time. The counters cover the whole server, not just this session.
+ * Input:
+ * 	- address where the statistics are stored
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_client_stats(tfs_stats *stats);
+
+/* Submits a write without waiting for its reply: the request is
+ * pipelined down the session's transport and a completion handle comes
+ * back immediately, so several writes can be in flight before the first
+ * reply arrives (up to TFS_ASYNC_MAX at a time). The result is collected
+ * later with tfs_wait() or tfs_wait_any(); until then the handle's slot
+ * stays busy, so every handle must eventually be waited on.
+ * Input:
+ * 	- file handle (obtained from a previous call to tfs_open)
+ * 	- buffer containing the contents to write (copied before returning,
+ * 	  so the caller may reuse it immediately)
+ * 	- length of the contents (in bytes, at most one block)
+ *
+ * Returns a completion handle if successful, -1 otherwise (including
+ * every slot being taken by completions not yet collected).
+ */
+int tfs_write_async(int fhandle, void const *buffer, size_t len);
+
+/* Waits for one pipelined operation to complete.
+ * Input:
+ * 	- completion handle (obtained from tfs_write_async)
+ *
+ * Returns the operation's result (what the synchronous call would have
+ * returned), or -1 in case of error; the handle is freed either way.
+ */
+ssize_t tfs_wait(int handle);
+
+/* Waits for whichever pipelined operation completes first.
+ * Input:
+ * 	- address where the operation's result is stored
+ *
+ * Returns the completed operation's handle (freed, like in tfs_wait),
+ * or -1 if nothing is in flight or an error occurred.
+ */
+int tfs_wait_any(ssize_t *result);
+
 /*
  * Orders TecnicoFS server to wait until no file is open and then shutdown
  * Returns 0 if successful, -1 otherwise.
@@ -24,28 +24,106 @@ int write_until_success(int fd, void const *source, size_t size) {
 }
 
 
-/* 
+/*
  * Makes sure "read()" actually reads all the bytes the user requested
  * Inputs:
  *  - file descriptor to read from
  *  - destination of the content read
  *  - size of the content
- * Returns: 0 if successful, -1 otherwise
+ * Returns: 0 if successful, -1 otherwise (including the writer closing
+ * its end before the full content arrived)
  */
 int read_until_success(int fd, void *destination, size_t size) {
-    ssize_t offset = 0, rd;
-    while ((rd = read(fd, destination + offset, size)) != size || errno == EINTR) {
+    size_t offset = 0;
+
+    while (offset < size) {
+        ssize_t rd = read(fd, destination + offset, size - offset);
+
         if (rd == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
             return -1;
         }
+        if (rd == 0) {
+            /* EOF before the full content arrived */
+            return -1;
+        }
+
         /* Updates the current offset */
-        offset += rd;
+        offset += (size_t)rd;
     }
 
     return 0;
 }
 
 
+/*
+ * Writes a length-prefixed message: a LEN_SIZE header holding the payload
+ * size, followed by exactly "size" payload bytes. The header and payload
+ * go out in a single write(), so frames from concurrent writers to the
+ * same pipe (e.g. several clients on the server's pipe) can't interleave,
+ * as long as the whole frame fits in PIPE_BUF.
+ * Inputs:
+ *  - file descriptor to write to
+ *  - source of the payload
+ *  - size of the payload (at most MAX_REQUEST_SIZE)
+ * Returns: 0 if successful, -1 otherwise
+ */
+int write_framed(int fd, void const *source, size_t size) {
+    char frame[LEN_SIZE + MAX_REQUEST_SIZE];
+
+    if (size > MAX_REQUEST_SIZE) {
+        return -1;
+    }
+
+    memcpy(frame, &size, LEN_SIZE);
+    memcpy(frame + LEN_SIZE, source, size);
+
+    return write_until_success(fd, frame, LEN_SIZE + size);
+}
+
+
+/*
+ * Reads one length-prefixed message: the LEN_SIZE header first, then
+ * exactly the payload it announces.
+ * Inputs:
+ *  - file descriptor to read from
+ *  - destination for the payload
+ *  - capacity of the destination
+ * Returns: the payload's size if successful, 0 if the pipe hit EOF before
+ * a new frame started (every writer closed), -1 otherwise
+ */
+ssize_t read_framed(int fd, void *destination, size_t max_size) {
+    size_t size;
+    ssize_t rd;
+
+    while ((rd = read(fd, &size, LEN_SIZE)) == -1 && errno == EINTR) {
+        /* Nothing to do */
+    }
+    if (rd <= 0) {
+        /* 0 is a clean EOF (no frame in flight), -1 a real error */
+        return rd;
+    }
+
+    /* In the (rare) case the header itself arrived split, finish it */
+    if ((size_t)rd < LEN_SIZE &&
+        read_until_success(fd, (char *)&size + rd, LEN_SIZE - (size_t)rd) != 0) {
+        return -1;
+    }
+
+    if (size > max_size) {
+        return -1;
+    }
+
+    if (size > 0 && read_until_success(fd, destination, size) != 0) {
+        return -1;
+    }
+
+    return (ssize_t)size;
+}
+
+
 /*
  * Makes sure "open()" actually opens the pipe given
  * Inputs:
@@ -74,4 +152,236 @@ int close_until_success(int fd) {
         /* Nothing to do */
     }
     return x;
+}
+
+
+/*
+ * Initializes one ring of a shared-memory channel: since the two ends
+ * live in different processes, the mutex and condition variables are
+ * created process-shared
+ * Inputs:
+ *  - ring to initialize
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int shm_ring_init(shm_ring_t *ring) {
+    pthread_mutexattr_t mutex_attr;
+    pthread_condattr_t cond_attr;
+
+    if (pthread_mutexattr_init(&mutex_attr) != 0 ||
+        pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED) != 0) {
+        return -1;
+    }
+    if (pthread_condattr_init(&cond_attr) != 0 ||
+        pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED) != 0) {
+        return -1;
+    }
+
+    if (pthread_mutex_init(&ring->ring_mutex, &mutex_attr) != 0 ||
+        pthread_cond_init(&ring->ring_data_cond, &cond_attr) != 0 ||
+        pthread_cond_init(&ring->ring_space_cond, &cond_attr) != 0) {
+        return -1;
+    }
+
+    pthread_mutexattr_destroy(&mutex_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    ring->head = 0;
+    ring->len = 0;
+    ring->closed = 0;
+
+    return 0;
+}
+
+
+/*
+ * Initializes a session's shared-memory channel (both rings), to be
+ * called once by the side that created the segment, before the other
+ * side gets to see it
+ * Inputs:
+ *  - channel to initialize
+ * Returns: 0 if successful, -1 otherwise
+ */
+int shm_channel_init(shm_channel_t *channel) {
+    if (shm_ring_init(&channel->request_ring) != 0 ||
+        shm_ring_init(&channel->reply_ring) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * Marks both rings of a channel as closed and wakes up anyone blocked on
+ * them: every later (or pending) read and write on the channel fails,
+ * which is how the other side learns the session is over
+ * Inputs:
+ *  - channel to close
+ */
+void shm_channel_close(shm_channel_t *channel) {
+    shm_ring_t *rings[2] = {&channel->request_ring, &channel->reply_ring};
+
+    for (int i = 0; i < 2; i++) {
+        if (pthread_mutex_lock(&rings[i]->ring_mutex) != 0) {
+            continue;
+        }
+        rings[i]->closed = 1;
+        pthread_cond_broadcast(&rings[i]->ring_data_cond);
+        pthread_cond_broadcast(&rings[i]->ring_space_cond);
+        pthread_mutex_unlock(&rings[i]->ring_mutex);
+    }
+}
+
+
+/*
+ * Writes "size" bytes into a ring, waiting while it is full, the
+ * shared-memory counterpart of write_until_success()
+ * Inputs:
+ *  - ring to write to
+ *  - source of the data
+ *  - size of the data
+ * Returns: 0 if successful, -1 otherwise (including a closed ring)
+ */
+int shm_ring_write(shm_ring_t *ring, void const *source, size_t size) {
+    char const *src = source;
+    size_t written = 0;
+
+    if (pthread_mutex_lock(&ring->ring_mutex) != 0) {
+        return -1;
+    }
+
+    while (written < size) {
+        while (ring->len == SHM_RING_CAPACITY && !ring->closed) {
+            if (pthread_cond_wait(&ring->ring_space_cond, &ring->ring_mutex) != 0) {
+                pthread_mutex_unlock(&ring->ring_mutex);
+                return -1;
+            }
+        }
+        if (ring->closed) {
+            pthread_mutex_unlock(&ring->ring_mutex);
+            return -1;
+        }
+
+        /* Copies as much as fits before the buffer's end or the reader's
+         * position, whichever comes first */
+        size_t tail = (ring->head + ring->len) % SHM_RING_CAPACITY;
+        size_t chunk = size - written;
+        if (chunk > SHM_RING_CAPACITY - ring->len) {
+            chunk = SHM_RING_CAPACITY - ring->len;
+        }
+        if (chunk > SHM_RING_CAPACITY - tail) {
+            chunk = SHM_RING_CAPACITY - tail;
+        }
+
+        memcpy(ring->data + tail, src + written, chunk);
+        ring->len += chunk;
+        written += chunk;
+
+        pthread_cond_signal(&ring->ring_data_cond);
+    }
+
+    return pthread_mutex_unlock(&ring->ring_mutex) == 0 ? 0 : -1;
+}
+
+
+/*
+ * Reads exactly "size" bytes off a ring, waiting while it is empty, the
+ * shared-memory counterpart of read_until_success()
+ * Inputs:
+ *  - ring to read from
+ *  - destination of the content read
+ *  - size of the content
+ * Returns: 0 if successful, -1 otherwise (including the ring closing
+ * before the full content arrived)
+ */
+int shm_ring_read(shm_ring_t *ring, void *destination, size_t size) {
+    char *dest = destination;
+    size_t offset = 0;
+
+    if (pthread_mutex_lock(&ring->ring_mutex) != 0) {
+        return -1;
+    }
+
+    while (offset < size) {
+        while (ring->len == 0 && !ring->closed) {
+            if (pthread_cond_wait(&ring->ring_data_cond, &ring->ring_mutex) != 0) {
+                pthread_mutex_unlock(&ring->ring_mutex);
+                return -1;
+            }
+        }
+        if (ring->len == 0 && ring->closed) {
+            pthread_mutex_unlock(&ring->ring_mutex);
+            return -1;
+        }
+
+        size_t chunk = size - offset;
+        if (chunk > ring->len) {
+            chunk = ring->len;
+        }
+        if (chunk > SHM_RING_CAPACITY - ring->head) {
+            chunk = SHM_RING_CAPACITY - ring->head;
+        }
+
+        memcpy(dest + offset, ring->data + ring->head, chunk);
+        ring->head = (ring->head + chunk) % SHM_RING_CAPACITY;
+        ring->len -= chunk;
+        offset += chunk;
+
+        pthread_cond_signal(&ring->ring_space_cond);
+    }
+
+    return pthread_mutex_unlock(&ring->ring_mutex) == 0 ? 0 : -1;
+}
+
+
+/*
+ * Writes a length-prefixed message into a ring, mirroring write_framed()
+ * on a pipe. Each ring has a single producer, so writing the header and
+ * the payload separately can't interleave with anyone
+ * Inputs:
+ *  - ring to write to
+ *  - source of the payload
+ *  - size of the payload (at most MAX_REQUEST_SIZE)
+ * Returns: 0 if successful, -1 otherwise
+ */
+int shm_ring_write_framed(shm_ring_t *ring, void const *source, size_t size) {
+    if (size > MAX_REQUEST_SIZE) {
+        return -1;
+    }
+
+    if (shm_ring_write(ring, &size, LEN_SIZE) != 0) {
+        return -1;
+    }
+
+    return shm_ring_write(ring, source, size);
+}
+
+
+/*
+ * Reads one length-prefixed message off a ring, mirroring read_framed()
+ * on a pipe.
+ * Inputs:
+ *  - ring to read from
+ *  - destination for the payload
+ *  - capacity of the destination
+ * Returns: the payload's size if successful, 0 if the ring was closed
+ * before a new frame started, -1 otherwise
+ */
+ssize_t shm_ring_read_framed(shm_ring_t *ring, void *destination, size_t max_size) {
+    size_t size;
+
+    if (shm_ring_read(ring, &size, LEN_SIZE) != 0) {
+        /* The producer writes whole frames, so a closed ring here is a
+         * clean end of the stream, not a broken frame */
+        return ring->closed ? 0 : -1;
+    }
+
+    if (size > max_size) {
+        return -1;
+    }
+
+    if (size > 0 && shm_ring_read(ring, destination, size) != 0) {
+        return -1;
+    }
+
+    return (ssize_t)size;
 }
\ No newline at end of file
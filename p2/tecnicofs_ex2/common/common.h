@@ -45,19 +45,120 @@
  * "read" and "write" command calls */
 #define RDWR_VAL_SIZE (sizeof(ssize_t))
 
-/* Maximum number of sessions to the server */
-#define MAX_SERVER_SESSIONS (20)
+/* The server's session table grows on demand, one segment of sessions
+ * at a time (a session's address must never change once handed to its
+ * worker thread, so the table grows by adding whole segments rather
+ * than by reallocating) */
+#define SESSION_SEGMENT_SIZE (16)
+
+/* Size used for the request buffer to recieve messages from the client.
+ * The biggest request is a compound "put" (open+write+close in one
+ * frame): op code, session id, file name, length and a full block */
+#define MAX_REQUEST_SIZE (OP_CODE_SIZE + SESSION_ID_SIZE + MAX_CPATH_LEN + LEN_SIZE + 1024)
+
+/* Number of pending requests a session's queue can hold before the
+ * receiver has to wait for the session's worker to catch up */
+#define SESSION_QUEUE_SIZE (8)
+
+/* Request buffers owned by each session: one per queue entry plus one
+ * for the frame currently being received, so a session's receiver never
+ * starves nor deadlocks */
+#define SESSION_SLOT_COUNT (SESSION_QUEUE_SIZE + 1)
+
+/* Capacity of each shared-memory ring buffer (enough for a few requests
+ * of the maximum size, frame header included) */
+#define SHM_RING_CAPACITY (4096)
+
+/* One direction of a shared-memory channel: a bounded byte stream with a
+ * single producer and a single consumer living in different processes.
+ * The mutex and condition variables are process-shared; "closed" wakes
+ * both sides up for good when either one tears the channel down */
+typedef struct {
+    pthread_mutex_t ring_mutex;
+    pthread_cond_t ring_data_cond;
+    pthread_cond_t ring_space_cond;
+
+    size_t head;
+    size_t len;
+    int closed;
+
+    char data[SHM_RING_CAPACITY];
+} shm_ring_t;
+
+/* A session's shared-memory channel: requests flow client -> server on
+ * one ring and replies server -> client on the other, replacing the pair
+ * of pipes of a FIFO session. The whole struct lives in a shm segment
+ * created by the client and mapped by both sides */
+typedef struct {
+    shm_ring_t request_ring;
+    shm_ring_t reply_ring;
+} shm_channel_t;
+
+/* Statistics kept by the filesystem and fetched from a live server with
+ * tfs_client_stats(): operation counts and bytes moved since startup,
+ * how full each table is, and the cumulative time threads spent waiting
+ * for the filesystem's global lock (waiting only, not holding) */
+typedef struct {
+    size_t open_calls;
+    size_t close_calls;
+    size_t read_calls;
+    size_t write_calls;
 
-/* Size used for the request buffer to recieve messages from the client */
-#define MAX_REQUEST_SIZE (OP_CODE_SIZE + SESSION_ID_SIZE + FHANDLE_SIZE + LEN_SIZE + 1024)
+    size_t bytes_read;
+    size_t bytes_written;
+
+    size_t inodes_used;
+    size_t inodes_total;
+    size_t data_blocks_used;
+    size_t data_blocks_total;
+    size_t open_files_used;
+    size_t open_files_total;
+
+    size_t lock_wait_ns;
+} tfs_stats;
 
 typedef struct {
-    /* Clients pipe file descriptor */
+    /* The session's own id (its index in the server's table) and whether
+     * the entry is currently taken by a mounted client */
+    int session_id;
+    char taken;
+
+    /* Clients pipe file descriptor (-1 for shared-memory sessions) */
     int client_fd;
 
-    /* Client's mutex / cond var */
+    /* The session's private request pipe, read by its receiver thread
+     * (-1 for shared-memory sessions, which read a ring instead) */
+    int request_fd;
+
+    /* Shared-memory channel of the session, when the client mounted over
+     * shared memory instead of pipes */
+    int use_shm;
+    shm_channel_t *shm;
+
+    /* Client's mutex / cond vars (protecting the request queue below:
+     * client_cond is signaled when the queue gains a request,
+     * client_space_cond when it gains free space, slot_cond when a
+     * request buffer is released) */
     pthread_mutex_t client_mutex;
     pthread_cond_t client_cond;
+    pthread_cond_t client_space_cond;
+    pthread_cond_t slot_cond;
+
+    /* Bounded producer/consumer queue of pending requests: the session's
+     * receiver pushes pointers to the request slots below and the
+     * session's worker thread pops and executes them, releasing each
+     * slot once it is done with it */
+    char *request_queue[SESSION_QUEUE_SIZE];
+    size_t queue_head;
+    size_t queue_len;
+
+    /* The session's private pool of request buffers: frames are read
+     * straight into a free slot and only pointers move through the
+     * queue, so no request is ever copied twice and no allocation
+     * happens on the request path */
+    char request_slots[SESSION_SLOT_COUNT][MAX_REQUEST_SIZE];
+    int free_slot_stack[SESSION_SLOT_COUNT];
+    int slot_sp;
 
 } client_session_t;
 
@@ -76,12 +177,41 @@ enum {
     TFS_OP_CODE_CLOSE = 4,
     TFS_OP_CODE_WRITE = 5,
     TFS_OP_CODE_READ = 6,
-    TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED = 7
+    TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED = 7,
+
+    /* A chunk of data belonging to a streamed write (a WRITE request
+     * whose declared length is bigger than MAX_RDWR_SIZE): the chunks
+     * follow the request back to back, with no per-chunk reply */
+    TFS_OP_CODE_DATA = 8,
+
+    /* Compound operations: a whole open -> write -> close (or
+     * open -> read -> close) in a single request and a single reply,
+     * saving two round trips for the small-file pattern */
+    TFS_OP_CODE_OPEN_WRITE_CLOSE = 9,
+    TFS_OP_CODE_OPEN_READ_CLOSE = 10,
+
+    /* A mount over shared memory: the payload is the name of a shm
+     * segment (created by the client) holding a shm_channel_t, which
+     * carries every later request and reply of the session instead of
+     * the pipes */
+    TFS_OP_CODE_MOUNT_SHM = 11,
+
+    /* Fetches the server's tfs_stats in one round trip */
+    TFS_OP_CODE_STATS = 12
 };
 
 int write_until_success(int fd, void const *source, size_t size);
 int read_until_success(int fd, void *destination, size_t size);
+int write_framed(int fd, void const *source, size_t size);
+ssize_t read_framed(int fd, void *destination, size_t max_size);
 int open_until_success(char const *pipe_path, int oflag);
 int close_until_success(int fd);
 
+int shm_channel_init(shm_channel_t *channel);
+void shm_channel_close(shm_channel_t *channel);
+int shm_ring_write(shm_ring_t *ring, void const *source, size_t size);
+int shm_ring_read(shm_ring_t *ring, void *destination, size_t size);
+int shm_ring_write_framed(shm_ring_t *ring, void const *source, size_t size);
+ssize_t shm_ring_read_framed(shm_ring_t *ring, void *destination, size_t max_size);
+
 #endif /* COMMON_H */
\ No newline at end of file
@@ -4,9 +4,40 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <time.h>
 
 static pthread_mutex_t single_global_lock;
 
+/* Cumulative statistics (see tfs_get_stats). The counters are bumped
+ * while the global lock is already held, so keeping them costs nothing
+ * extra; only the occupancy fields are filled in on demand. Since every
+ * operation serializes on the one lock anyway, there is no point in
+ * keeping the counters per thread here */
+static tfs_stats fs_stats;
+
+/* Locks the global lock, charging any time spent blocked to the
+ * statistics. The uncontended path costs a single trylock: the clock is
+ * only read when the lock is actually fought over */
+static int stats_global_lock() {
+    if (pthread_mutex_trylock(&single_global_lock) == 0) {
+        return 0;
+    }
+
+    struct timespec t0;
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (pthread_mutex_lock(&single_global_lock) != 0) {
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    fs_stats.lock_wait_ns +=
+        (size_t)((t1.tv_sec - t0.tv_sec) * 1000000000L +
+                 (t1.tv_nsec - t0.tv_nsec));
+    return 0;
+}
+
 /* conditional variable used on "tfs_destroy_after_all_closed()" */
 static pthread_cond_t of_cond;
 
@@ -35,6 +66,9 @@ int tfs_init() {
     /* Flag initialized at 0 meaning it is false */
     destroy_wait_flag = 0;
 
+    /* The statistics restart together with the filesystem */
+    memset(&fs_stats, 0, sizeof(fs_stats));
+
     /* create root inode */
     int root = inode_create(T_DIRECTORY);
     if (root != ROOT_DIR_INUM) {
@@ -61,7 +95,7 @@ static bool valid_pathname(char const *name) {
 }
 
 int tfs_destroy_after_all_closed() {
-    if (pthread_mutex_lock(&single_global_lock) != 0) {
+    if (stats_global_lock() != 0) {
         return -1;
     }
 
@@ -93,7 +127,7 @@ int _tfs_lookup_unsynchronized(char const *name) {
 }
 
 int tfs_lookup(char const *name) {
-    if (pthread_mutex_lock(&single_global_lock) != 0)
+    if (stats_global_lock() != 0)
         return -1;
     int ret = _tfs_lookup_unsynchronized(name);
     if (pthread_mutex_unlock(&single_global_lock) != 0)
@@ -155,17 +189,21 @@ static int _tfs_open_unsynchronized(char const *name, int flags) {
 }
 
 int tfs_open(char const *name, int flags) {
-    if (pthread_mutex_lock(&single_global_lock) != 0)
+    if (stats_global_lock() != 0)
         return -1;
 
+    fs_stats.open_calls++;
+
     /* If we are waiting for the system to shutdown, we won't
      * allow any more "tfs_open()" calls */
     if (destroy_wait_flag == 1) {
+        pthread_mutex_unlock(&single_global_lock);
         return -1;
     }
 
     int ret = _tfs_open_unsynchronized(name, flags);
     if (ret == -1) {
+        pthread_mutex_unlock(&single_global_lock);
         return -1;
     }
 
@@ -180,11 +218,14 @@ int tfs_open(char const *name, int flags) {
 }
 
 int tfs_close(int fhandle) {
-    if (pthread_mutex_lock(&single_global_lock) != 0)
+    if (stats_global_lock() != 0)
         return -1;
 
+    fs_stats.close_calls++;
+
     int r = remove_from_open_file_table(fhandle);
     if (r == -1) {
+        pthread_mutex_unlock(&single_global_lock);
         return -1;
     }
 
@@ -248,9 +289,13 @@ static ssize_t _tfs_write_unsynchronized(int fhandle, void const *buffer,
 }
 
 ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
-    if (pthread_mutex_lock(&single_global_lock) != 0)
+    if (stats_global_lock() != 0)
         return -1;
     ssize_t ret = _tfs_write_unsynchronized(fhandle, buffer, to_write);
+
+    fs_stats.write_calls++;
+    fs_stats.bytes_written += (ret > 0) ? (size_t)ret : 0;
+
     if (pthread_mutex_unlock(&single_global_lock) != 0)
         return -1;
 
@@ -292,11 +337,106 @@ static ssize_t _tfs_read_unsynchronized(int fhandle, void *buffer, size_t len) {
 }
 
 ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
-    if (pthread_mutex_lock(&single_global_lock) != 0)
+    if (stats_global_lock() != 0)
         return -1;
     ssize_t ret = _tfs_read_unsynchronized(fhandle, buffer, len);
+
+    fs_stats.read_calls++;
+    fs_stats.bytes_read += (ret > 0) ? (size_t)ret : 0;
+
+    if (pthread_mutex_unlock(&single_global_lock) != 0)
+        return -1;
+
+    return ret;
+}
+
+static ssize_t _tfs_read_to_fd_unsynchronized(int fhandle, int out_fd,
+                                              size_t len) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+
+    /* From the open file table entry, we get the inode */
+    inode_t *inode = inode_get(file->of_inumber);
+    if (inode == NULL) {
+        return -1;
+    }
+
+    /* Determine how many bytes to read */
+    size_t to_read = inode->i_size - file->of_offset;
+    if (to_read > len) {
+        to_read = len;
+    }
+
+    /* The byte count and the data go out in one writev(), pointing
+     * straight at the data block so the contents are never staged in an
+     * intermediate buffer */
+    ssize_t count = (ssize_t)to_read;
+    struct iovec iov[2];
+    iov[0].iov_base = &count;
+    iov[0].iov_len = RDWR_VAL_SIZE;
+    int iovcnt = 1;
+
+    if (to_read > 0) {
+        void *block = data_block_get(inode->i_data_block);
+        if (block == NULL) {
+            return -1;
+        }
+        iov[1].iov_base = block + file->of_offset;
+        iov[1].iov_len = to_read;
+        iovcnt = 2;
+    }
+
+    ssize_t wr;
+    while ((wr = writev(out_fd, iov, iovcnt)) == -1 && errno == EINTR) {
+        /* Nothing to do */
+    }
+    if (wr != (ssize_t)(RDWR_VAL_SIZE + to_read)) {
+        return -1;
+    }
+
+    /* The offset associated with the file handle is
+     * incremented accordingly */
+    file->of_offset += to_read;
+
+    return count;
+}
+
+ssize_t tfs_read_to_fd(int fhandle, int out_fd, size_t len) {
+    if (stats_global_lock() != 0)
+        return -1;
+    ssize_t ret = _tfs_read_to_fd_unsynchronized(fhandle, out_fd, len);
+
+    fs_stats.read_calls++;
+    fs_stats.bytes_read += (ret > 0) ? (size_t)ret : 0;
+
     if (pthread_mutex_unlock(&single_global_lock) != 0)
         return -1;
 
     return ret;
 }
+
+int tfs_get_stats(tfs_stats *stats) {
+    if (stats == NULL) {
+        return -1;
+    }
+
+    if (stats_global_lock() != 0) {
+        return -1;
+    }
+
+    *stats = fs_stats;
+    stats->inodes_used = state_inodes_used();
+    stats->inodes_total = INODE_TABLE_SIZE;
+    stats->data_blocks_used = state_data_blocks_used();
+    stats->data_blocks_total = DATA_BLOCKS;
+    stats->open_files_used = state_open_files_used();
+    stats->open_files_total = MAX_OPEN_FILES;
+
+    if (pthread_mutex_unlock(&single_global_lock) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -72,6 +72,20 @@ ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
  */
 ssize_t tfs_read(int fhandle, void *buffer, size_t len);
 
+/* Sends data from an open file straight into a file descriptor, starting
+ * at the current offset. The reply has the same shape the server uses on
+ * the client's pipe: the byte count (ssize_t) followed by the data, sent
+ * in a single writev() over the file's data block, with no intermediate
+ * copy of the contents.
+ * Input:
+ * 	- file handle (obtained from a previous call to tfs_open)
+ * 	- destination file descriptor (e.g. a client's pipe)
+ * 	- maximum number of bytes to send
+ * Returns the number of bytes sent (can be lower than 'len' if the file
+ * size was reached), or -1 in case of error
+ */
+ssize_t tfs_read_to_fd(int fhandle, int out_fd, size_t len);
+
 /* Copies the contents of a file that exists in TecnicoFS to the contents
  * of another file in the OS' file system tree (outside TecnicoFS).
  * Input:
@@ -82,4 +96,15 @@ ssize_t tfs_read(int fhandle, void *buffer, size_t len);
  */
 int tfs_copy_to_external_fs(char const *source_path, char const *dest_path);
 
+/* Fills in the filesystem's statistics (see the tfs_stats struct in
+ * common/common.h): operation counts and bytes moved since startup,
+ * table occupancy and cumulative lock-wait time. Cheap enough to stay
+ * enabled in production: the counters are maintained under the lock
+ * every operation already takes.
+ * Input:
+ *      - address where the statistics are stored
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_get_stats(tfs_stats *stats);
+
 #endif // OPERATIONS_H
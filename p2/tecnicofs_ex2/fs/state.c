@@ -337,3 +337,40 @@ open_file_entry_t *get_open_file_entry(int fhandle) {
     }
     return &open_file_table[fhandle];
 }
+
+/* The three counters below feed the statistics (tfs_get_stats): they
+ * only look at the free maps, so no storage access delay is simulated
+ * (monitoring should stay cheap) */
+
+/* Returns: how many i-nodes are currently taken */
+size_t state_inodes_used() {
+    size_t used = 0;
+    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
+        if (freeinode_ts[i] == TAKEN) {
+            used++;
+        }
+    }
+    return used;
+}
+
+/* Returns: how many data blocks are currently taken */
+size_t state_data_blocks_used() {
+    size_t used = 0;
+    for (int i = 0; i < DATA_BLOCKS; i++) {
+        if (free_blocks[i] == TAKEN) {
+            used++;
+        }
+    }
+    return used;
+}
+
+/* Returns: how many open file entries are currently taken */
+size_t state_open_files_used() {
+    size_t used = 0;
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        if (free_open_file_entries[i] == TAKEN) {
+            used++;
+        }
+    }
+    return used;
+}
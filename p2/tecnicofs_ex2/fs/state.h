@@ -58,4 +58,8 @@ int add_to_open_file_table(int inumber, size_t offset);
 int remove_from_open_file_table(int fhandle);
 open_file_entry_t *get_open_file_entry(int fhandle);
 
+size_t state_inodes_used();
+size_t state_data_blocks_used();
+size_t state_open_files_used();
+
 #endif // STATE_H
@@ -2,21 +2,120 @@
 
 /* Extra includes */
 #include "common/common.h"
+#include <sys/mman.h>
 #include <sys/types.h>
 
-/* Session ID table */
-static client_session_t session_id_table[MAX_SERVER_SESSIONS];
-static char free_session_table[MAX_SERVER_SESSIONS];
+/* Session table, grown on demand one segment at a time. The pointer
+ * array itself is fixed (so lock-free readers like session_get never
+ * race a reallocation) and only its entries get allocated, which still
+ * leaves room for thousands of simultaneous sessions; the sessions
+ * themselves never move, since their worker and receiver threads hold
+ * pointers to them */
+#define MAX_SESSION_SEGMENTS (1024)
 
-/* Session's thread table */
-static pthread_t session_thread_table[MAX_SERVER_SESSIONS];
+static client_session_t *session_segments[MAX_SESSION_SEGMENTS];
+static int session_segment_count;
+static int session_capacity;
+
+/* Stack of free session ids, for O(1) allocation however large the
+ * table grows */
+static int *free_session_stack;
+static int free_session_sp;
 
 /* Server global mutex */
 static pthread_mutex_t server_mutex;
 
+void *session_worker(void *arg);
+void *pipe_session_receiver(void *arg);
+void *shm_session_receiver(void *arg);
+client_session_t *session_get(int session_id);
+
+/* Replies to shared-memory sessions are addressed with a negative value
+ * encoding the session id (never colliding with -1, the usual error
+ * marker), so the handlers keep taking a single "destination" int
+ * whether the session is pipe- or shm-based */
+#define SHM_DEST(session_id) (-(session_id) - 2)
+#define IS_SHM_DEST(dest_fd) ((dest_fd) <= -2)
+
 
 static inline bool valid_session_id(int session_id) {
-    return session_id >= 0 && session_id < MAX_SERVER_SESSIONS;
+    return session_id >= 0 && session_id < session_capacity;
+}
+
+
+/*
+ * Grows the session table by one segment (with server_mutex held): the
+ * new sessions are initialized, their ids pushed onto the free stack and
+ * their worker threads created, so nothing is ever spawned or allocated
+ * on the request path itself
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int session_segment_add(void) {
+    if (session_segment_count == MAX_SESSION_SEGMENTS) {
+        return -1;
+    }
+
+    client_session_t *segment = malloc(SESSION_SEGMENT_SIZE * sizeof(client_session_t));
+    if (segment == NULL) {
+        return -1;
+    }
+
+    int *stack = realloc(free_session_stack,
+                         (size_t)(session_capacity + SESSION_SEGMENT_SIZE) * sizeof(int));
+    if (stack == NULL) {
+        free(segment);
+        return -1;
+    }
+    free_session_stack = stack;
+
+    for (int i = 0; i < SESSION_SEGMENT_SIZE; i++) {
+        client_session_t *session = &segment[i];
+
+        session->session_id = session_capacity + i;
+        session->taken = FREE;
+        session->client_fd = -1;
+        session->request_fd = -1;
+        session->use_shm = 0;
+        session->shm = NULL;
+
+        if (pthread_mutex_init(&session->client_mutex, NULL) != 0 ||
+            pthread_cond_init(&session->client_cond, NULL) != 0 ||
+            pthread_cond_init(&session->client_space_cond, NULL) != 0 ||
+            pthread_cond_init(&session->slot_cond, NULL) != 0) {
+            free(segment);
+            return -1;
+        }
+
+        /* The session's request queue starts empty and every one of its
+         * request buffers starts free */
+        session->queue_head = 0;
+        session->queue_len = 0;
+        for (int j = 0; j < SESSION_SLOT_COUNT; j++) {
+            session->free_slot_stack[j] = j;
+        }
+        session->slot_sp = SESSION_SLOT_COUNT;
+    }
+
+    session_segments[session_segment_count] = segment;
+
+    /* Pushed in reverse so the lowest ids come off the stack first */
+    for (int i = SESSION_SEGMENT_SIZE - 1; i >= 0; i--) {
+        free_session_stack[free_session_sp++] = session_capacity + i;
+    }
+
+    session_segment_count++;
+    session_capacity += SESSION_SEGMENT_SIZE;
+
+    /* One worker per session, for the session's whole lifetime */
+    for (int i = 0; i < SESSION_SEGMENT_SIZE; i++) {
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, session_worker, &segment[i]) != 0 ||
+            pthread_detach(worker) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
 }
 
 
@@ -44,17 +143,11 @@ void tfs_server_init(char const *server_pipe_path) {
         exit(1);
     }
 
-    for (size_t i = 0; i < MAX_SERVER_SESSIONS; i++) {
-        free_session_table[i] = FREE;
-        if (pthread_mutex_init(&session_id_table[i].client_mutex, NULL) != 0) {
-            pthread_mutex_destroy(&server_mutex);
-            exit(1);
-        }
-        if (pthread_cond_init(&session_id_table[i].client_cond, NULL) != 0) {
-            pthread_mutex_destroy(&session_id_table[i].client_mutex);
-            pthread_mutex_destroy(&server_mutex);
-            exit(1);
-        }
+    /* The table starts with a single segment of sessions (workers
+     * included) and grows, a segment at a time, as mounts need it */
+    if (session_segment_add() != 0) {
+        pthread_mutex_destroy(&server_mutex);
+        exit(1);
     }
 }
 
@@ -70,9 +163,18 @@ void tfs_server_destroy(int server_fd) {
         exit(1);
     }
 
-    for (size_t i = 0; i < MAX_SERVER_SESSIONS; i++) {
+    for (int i = 0; i < session_capacity; i++) {
+        client_session_t *session =
+            &session_segments[i / SESSION_SEGMENT_SIZE][i % SESSION_SEGMENT_SIZE];
+
         /* TODO: maybe unlink the clients? */
-        if (close_until_success(session_id_table[i].client_fd) != 0) {
+        if (session->client_fd != -1 &&
+            close_until_success(session->client_fd) != 0) {
+            perror("[ERR]");
+            exit(1);
+        }
+        if (session->request_fd != -1 &&
+            close_until_success(session->request_fd) != 0) {
             perror("[ERR]");
             exit(1);
         }
@@ -114,49 +216,140 @@ int session_id_unlock(client_session_t *session) {
 
 
 /*
- * Puts a session on hold (wait)
+ * Grabs a free request buffer off a session's pool, waiting while every
+ * slot is in use
+ * Inputs:
+ *  - session the buffer will belong to
+ * Returns: pointer to the slot if successful, NULL otherwise
+ */
+char *session_slot_alloc(client_session_t *session) {
+    if (session_id_lock(session) != 0) {
+        return NULL;
+    }
+
+    while (session->slot_sp == 0) {
+        if (pthread_cond_wait(&session->slot_cond, &session->client_mutex) != 0) {
+            session_id_unlock(session);
+            return NULL;
+        }
+    }
+
+    int slot = session->free_slot_stack[--session->slot_sp];
+
+    if (session_id_unlock(session) != 0) {
+        return NULL;
+    }
+
+    return session->request_slots[slot];
+}
+
+
+/*
+ * Returns a request buffer to its session's pool, once its request has
+ * been fully handled
  * Inputs:
- * - session we want to wait
+ *  - session the buffer belongs to
+ *  - slot previously handed out by session_slot_alloc()
  * Returns: 0 if successful, -1 otherwise
  */
-int session_cond_wait(client_session_t *session) {
+int session_slot_free(client_session_t *session, char *slot) {
+    int index = (int)((slot - &session->request_slots[0][0]) /
+                      (ssize_t)MAX_REQUEST_SIZE);
+
+    if (index < 0 || index >= SESSION_SLOT_COUNT) {
+        return -1;
+    }
+
     if (session_id_lock(session) != 0) {
         return -1;
     }
 
-    if (pthread_cond_wait(&session->client_cond, &session->client_mutex) != 0) {
+    session->free_slot_stack[session->slot_sp++] = index;
+
+    if (pthread_cond_signal(&session->slot_cond) != 0) {
         session_id_unlock(session);
         return -1;
     }
 
-    session_id_unlock(session);
-    return 0;
+    return session_id_unlock(session);
 }
 
 
 /*
- * Sends a signal to a session
+ * Pushes a request onto a session's queue (producer side), waiting while
+ * the queue is full
  * Inputs:
- * - session we want to signal
+ * - session the request belongs to
+ * - request pool slot holding the request (op code included)
  * Returns: 0 if successful, -1 otherwise
  */
-int session_cond_signal(client_session_t *session) {
+int session_queue_push(client_session_t *session, char *request) {
     if (session_id_lock(session) != 0) {
         return -1;
     }
 
+    while (session->queue_len == SESSION_QUEUE_SIZE) {
+        if (pthread_cond_wait(&session->client_space_cond,
+                              &session->client_mutex) != 0) {
+            session_id_unlock(session);
+            return -1;
+        }
+    }
+
+    size_t slot = (session->queue_head + session->queue_len) % SESSION_QUEUE_SIZE;
+    session->request_queue[slot] = request;
+    session->queue_len++;
+
     if (pthread_cond_signal(&session->client_cond) != 0) {
         session_id_unlock(session);
         return -1;
     }
 
-    session_id_unlock(session);
-    return 0;
+    return session_id_unlock(session);
 }
 
 
 /*
- * Allocates a new entry for the current session
+ * Pops the oldest request off a session's queue (consumer side), waiting
+ * while the queue is empty. The caller owns the returned slot and must
+ * hand it back with request_slot_free() when done
+ * Inputs:
+ * - session the worker serves
+ * Returns: pointer to the request's pool slot if successful, NULL otherwise
+ */
+char *session_queue_pop(client_session_t *session) {
+    if (session_id_lock(session) != 0) {
+        return NULL;
+    }
+
+    while (session->queue_len == 0) {
+        if (pthread_cond_wait(&session->client_cond,
+                              &session->client_mutex) != 0) {
+            session_id_unlock(session);
+            return NULL;
+        }
+    }
+
+    char *request = session->request_queue[session->queue_head];
+    session->queue_head = (session->queue_head + 1) % SESSION_QUEUE_SIZE;
+    session->queue_len--;
+
+    if (pthread_cond_signal(&session->client_space_cond) != 0) {
+        session_id_unlock(session);
+        return NULL;
+    }
+
+    if (session_id_unlock(session) != 0) {
+        return NULL;
+    }
+
+    return request;
+}
+
+
+/*
+ * Allocates a new entry for the current session, in O(1) off the free
+ * stack, growing the table by a segment when it runs out
  * Returns: entry index if successful, -1 otherwise
  */
 int session_id_alloc() {
@@ -164,20 +357,25 @@ int session_id_alloc() {
         return -1;
     }
 
-    for (int i = 0; i < MAX_SERVER_SESSIONS; i++) {
-        if (free_session_table[i] == FREE) {
-            
-            free_session_table[i] = TAKEN;
+    if (free_session_sp == 0 && session_segment_add() != 0) {
+        pthread_mutex_unlock(&server_mutex);
+        return -1;
+    }
 
-            if (pthread_mutex_unlock(&server_mutex) != 0) {
-                return -1;
-            }
+    int session_id = free_session_stack[--free_session_sp];
 
-            return i;
-        }
+    client_session_t *session = session_get(session_id);
+    if (session == NULL) {
+        pthread_mutex_unlock(&server_mutex);
+        return -1;
     }
-    pthread_mutex_unlock(&server_mutex);
-    return -1;
+    session->taken = TAKEN;
+
+    if (pthread_mutex_unlock(&server_mutex) != 0) {
+        return -1;
+    }
+
+    return session_id;
 }
 
 
@@ -192,12 +390,14 @@ client_session_t *session_get(int session_id) {
         return NULL;
     }
 
-    return &session_id_table[session_id];
+    return &session_segments[session_id / SESSION_SEGMENT_SIZE]
+                            [session_id % SESSION_SEGMENT_SIZE];
 }
 
 
 /*
- * Frees an entry from the session_id table
+ * Frees an entry from the session table, putting its id back on the
+ * free stack
  * Inputs:
  *  - closing session's id
  * Returns: 0 if succsessful, -1 otherwise
@@ -211,7 +411,14 @@ int session_id_remove(int session_id) {
         return -1;
     }
 
-    free_session_table[session_id] = FREE;
+    client_session_t *session = session_get(session_id);
+    if (session == NULL || session->taken == FREE) {
+        pthread_mutex_unlock(&server_mutex);
+        return -1;
+    }
+
+    session->taken = FREE;
+    free_session_stack[free_session_sp++] = session_id;
 
     if (pthread_mutex_unlock(&server_mutex) != 0) {
         return -1;
@@ -221,15 +428,40 @@ int session_id_remove(int session_id) {
 }
 
 
+/*
+ * Sends part of a reply to a client, over whichever transport its
+ * session uses: a plain write to the client's pipe, or a write into the
+ * session's shared-memory reply ring when the destination is an encoded
+ * shm session (see SHM_DEST)
+ * Inputs:
+ *  - destination (client's pipe fd, or encoded shm session)
+ *  - source of the data
+ *  - size of the data
+ * Returns: 0 if successful, -1 otherwise
+ */
+int client_reply(int dest_fd, void const *source, size_t size) {
+    if (!IS_SHM_DEST(dest_fd)) {
+        return write_until_success(dest_fd, source, size);
+    }
+
+    client_session_t *session = session_get(-dest_fd - 2);
+    if (session == NULL || session->shm == NULL) {
+        return -1;
+    }
+
+    return shm_ring_write(&session->shm->reply_ring, source, size);
+}
+
+
 /* 
  * Sends a message (int) to a certain client
  * Inputs:
- *  - file to write the message to
+ *  - destination to write the message to
  *  - value to be sent
  * Returns: 0 if successful, -1 otherwise
  */
 int send_message(int dest_fd, int ret) {
-    if (write_until_success(dest_fd, &ret, RETURN_VAL_SIZE) != 0) {
+    if (client_reply(dest_fd, &ret, RETURN_VAL_SIZE) != 0) {
         return -1;
     }
     return 0;
@@ -245,10 +477,12 @@ int send_message(int dest_fd, int ret) {
 void tfs_server_mount(void const *arg) {
     char *args = (char*) arg;
 
-    /* Gets the argument we need for the mount command:
-     * <client pipe path name> */
+    /* Gets the arguments we need for the mount command:
+     * <client pipe path name> | <request pipe path name> */
     char client_pipe_path[MAX_CPATH_LEN];
     memcpy(client_pipe_path, args, MAX_CPATH_LEN);
+    char request_pipe_path[MAX_CPATH_LEN];
+    memcpy(request_pipe_path, args + MAX_CPATH_LEN, MAX_CPATH_LEN);
 
     /* Opens the client's pipe for every future witing */
     int client_fd = open_until_success(client_pipe_path, O_WRONLY);
@@ -257,17 +491,56 @@ void tfs_server_mount(void const *arg) {
         exit(1);
     }
 
+    /* Opens the session's private request pipe, which from here on
+     * carries every request of the session: the server's own pipe only
+     * ever sees mounts, so one client's backlog can't delay anyone
+     * else's requests */
+    int request_fd = open_until_success(request_pipe_path, O_RDONLY);
+    if (request_fd == -1) {
+        if (send_message(client_fd, -1) != 0) {
+            exit(1);
+        }
+        return;
+    }
+
     int session_id = session_id_alloc();
 
-    /* If session_id == -1 it means there is no more space for any more sessions
-     * to the server and so we notify the client with an error */
+    /* If session_id == -1 it means a session couldn't be set up, and so
+     * we notify the client with an error */
     if (session_id == -1) {
+        close_until_success(request_fd);
         if (send_message(client_fd, -1) != 0) {
             exit(1);
         }
         return;
     }
 
+    if (pthread_mutex_lock(&server_mutex) != 0) {
+        exit(1);
+    }
+
+    /* Fills the structs's fields with the client's information */
+    client_session_t *session = session_get(session_id);
+    if (session == NULL) {
+        exit(1);
+    }
+    session->client_fd = client_fd;
+    session->request_fd = request_fd;
+    session->use_shm = 0;
+    session->shm = NULL;
+
+    if (pthread_mutex_unlock(&server_mutex) != 0) {
+       exit(1);
+    }
+
+    /* One receiver per session, reading its private pipe and feeding the
+     * session's worker; it exits when the client closes the pipe */
+    pthread_t receiver;
+    if (pthread_create(&receiver, NULL, pipe_session_receiver, session) != 0 ||
+        pthread_detach(receiver) != 0) {
+        exit(1);
+    }
+
     /* Writes to the client's pipe its session id */
     if (write_until_success(client_fd, &session_id, SESSION_ID_SIZE) != 0) {
         if (send_message(client_fd, -1) != 0) {
@@ -275,17 +548,78 @@ void tfs_server_mount(void const *arg) {
         }
         return;
     }
+}
+
+
+/*
+ * Handles Mount requests over shared memory: the client already created
+ * and initialized a shm segment holding the session's channel, and sent
+ * us its name over the server's pipe. The segment gets mapped, a session
+ * allocated, and a receiver thread spawned to pull this session's
+ * requests off the channel's request ring (the server's pipe carries
+ * nothing else for the session). The session id travels back through the
+ * reply ring, -1 meaning no session was available.
+ * Inputs:
+ *  - arguments for mount_shm: <shm segment name>
+ */
+void tfs_server_mount_shm(void const *arg) {
+    char *args = (char*) arg;
+
+    char shm_name[MAX_CPATH_LEN];
+    memcpy(shm_name, args, MAX_CPATH_LEN);
+
+    int shm_fd = shm_open(shm_name, O_RDWR, 0);
+    if (shm_fd == -1) {
+        return;
+    }
+
+    shm_channel_t *channel = mmap(NULL, sizeof(shm_channel_t),
+                                  PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close_until_success(shm_fd);
+    if (channel == MAP_FAILED) {
+        return;
+    }
+
+    int session_id = session_id_alloc();
+
+    /* If session_id == -1 it means there is no more space for any more sessions
+     * to the server and so we notify the client with an error */
+    if (session_id == -1) {
+        int err = -1;
+        shm_ring_write(&channel->reply_ring, &err, SESSION_ID_SIZE);
+        munmap(channel, sizeof(shm_channel_t));
+        return;
+    }
 
     if (pthread_mutex_lock(&server_mutex) != 0) {
         exit(1);
     }
 
     /* Fills the structs's fields with the client's information */
-    session_id_table[session_id].client_fd = client_fd;
+    client_session_t *session = session_get(session_id);
+    if (session == NULL) {
+        exit(1);
+    }
+    session->client_fd = -1;
+    session->request_fd = -1;
+    session->use_shm = 1;
+    session->shm = channel;
 
     if (pthread_mutex_unlock(&server_mutex) != 0) {
        exit(1);
     }
+
+    /* One receiver per shm session, feeding the session's (pre-existing)
+     * worker; it exits when the client closes the channel */
+    pthread_t receiver;
+    if (pthread_create(&receiver, NULL, shm_session_receiver, session) != 0 ||
+        pthread_detach(receiver) != 0) {
+        exit(1);
+    }
+
+    if (shm_ring_write(&channel->reply_ring, &session_id, SESSION_ID_SIZE) != 0) {
+        exit(1);
+    }
 }
 
 
@@ -313,7 +647,11 @@ void tfs_server_unmount(void const *arg) {
         return;
     }
 
+    /* The session's entry is about to be freed (and possibly reused), so
+     * the reply goes through transport handles saved now */
     int client_fd = client_session->client_fd;
+    int use_shm = client_session->use_shm;
+    shm_channel_t *shm = client_session->shm;
 
     if (pthread_mutex_unlock(&server_mutex) != 0) {
         exit(1);
@@ -321,15 +659,23 @@ void tfs_server_unmount(void const *arg) {
     
     /* Removes the session from the system */
     if (session_id_remove(session_id) != 0) {
-        if (send_message(client_fd, -1) != 0) {
+        if (use_shm) {
+            int err = -1;
+            shm_ring_write(&shm->reply_ring, &err, RETURN_VAL_SIZE);
+        } else if (send_message(client_fd, -1) != 0) {
             exit(1);
         }
         return;
     }
 
-    /* If the client recieves a 0 through the pipe, unmount was successful */
+    /* If the client recieves a 0, unmount was successful */
     int success = 0;
-    /* Sends to the client its pipe's name (for unlinking by the client) */
+    if (use_shm) {
+        /* The client tears the channel down once this arrives, which is
+         * what makes the session's receiver thread exit */
+        shm_ring_write(&shm->reply_ring, &success, RETURN_VAL_SIZE);
+        return;
+    }
     if (write_until_success(client_fd, &success, RETURN_VAL_SIZE) != 0) {
         if (send_message(client_fd, -1) != 0) {
             exit(1);
@@ -363,7 +709,7 @@ void tfs_server_open(void const *arg) {
 
     /* If for some reason tfs_close() returns -1, it won't be a problem for now,
      * as the client will deal with it accordingly */
-    if (write_until_success(client_fd, &ret, RETURN_VAL_SIZE) != 0) {
+    if (client_reply(client_fd, &ret, RETURN_VAL_SIZE) != 0) {
         if (send_message(client_fd, -1) != 0) {
             exit(1);
         }
@@ -388,7 +734,7 @@ void tfs_server_close(void const *arg) {
 
     /* If for some reason tfs_close() returns -1, it won't be a problem for now,
      * as the client will deal with it accordingly */
-    if (write_until_success(client_fd, &ret, RETURN_VAL_SIZE) != 0) {
+    if (client_reply(client_fd, &ret, RETURN_VAL_SIZE) != 0) {
         if (send_message(client_fd, -1) != 0) {
             exit(1);
         }
@@ -397,7 +743,7 @@ void tfs_server_close(void const *arg) {
 }
 
 
-void tfs_server_write(void const *arg) {
+void tfs_server_write(client_session_t *session, void const *arg) {
     char *args = (char*) arg;
 
     /* Gets the arguments we need for the write command:
@@ -408,16 +754,59 @@ void tfs_server_write(void const *arg) {
     memcpy(&fhandle, args + SESSION_ID_SIZE, FHANDLE_SIZE);
     size_t len;
     memcpy(&len, args + SESSION_ID_SIZE + FHANDLE_SIZE, LEN_SIZE);
-    char to_write[len];
-    memcpy(to_write, args + SESSION_ID_SIZE + FHANDLE_SIZE + LEN_SIZE, MAX_RDWR_SIZE);
 
-    /* Stores the return value of tfs_close() */
     ssize_t ret;
-    ret = tfs_write(fhandle, to_write, len);
+
+    if (len <= MAX_RDWR_SIZE) {
+        /* The data came inline with the request */
+        char to_write[MAX_RDWR_SIZE];
+        memcpy(to_write, args + SESSION_ID_SIZE + FHANDLE_SIZE + LEN_SIZE, len);
+
+        ret = tfs_write(fhandle, to_write, len);
+    } else {
+        /* Streaming mode: the request only declared the total length and
+         * the data follows in back-to-back DATA frames on this session's
+         * queue, written out as they arrive so memory use stays bounded.
+         * The whole stream is consumed even if a write fails midway, so
+         * the session's pipe stays consistent */
+        size_t remaining = len;
+        ret = 0;
+
+        while (remaining > 0) {
+            char *data_frame = session_queue_pop(session);
+            if (data_frame == NULL) {
+                ret = -1;
+                break;
+            }
+            if (data_frame[0] != TFS_OP_CODE_DATA) {
+                session_slot_free(session, data_frame);
+                ret = -1;
+                break;
+            }
+
+            size_t chunk;
+            memcpy(&chunk, data_frame + OP_CODE_SIZE + SESSION_ID_SIZE, LEN_SIZE);
+            if (chunk == 0 || chunk > MAX_RDWR_SIZE || chunk > remaining) {
+                session_slot_free(session, data_frame);
+                ret = -1;
+                break;
+            }
+
+            ssize_t wr = tfs_write(fhandle,
+                                   data_frame + OP_CODE_SIZE + SESSION_ID_SIZE + LEN_SIZE,
+                                   chunk);
+            if (wr > 0) {
+                ret += wr;
+            }
+
+            remaining -= chunk;
+            session_slot_free(session, data_frame);
+        }
+    }
 
     /* If for some reason tfs_write() returns -1, it won't be a problem for now,
      * as the client will deal with it accordingly */
-    if (write_until_success(client_fd, &ret, RDWR_VAL_SIZE) != 0) {
+    if (client_reply(client_fd, &ret, RDWR_VAL_SIZE) != 0) {
         if (send_message(client_fd, -1) != 0) {
             exit(1);
         }
@@ -437,14 +826,156 @@ void tfs_server_read(void const *arg) {
     memcpy(&fhandle, args + SESSION_ID_SIZE, FHANDLE_SIZE);
     size_t len;
     memcpy(&len, args + SESSION_ID_SIZE + FHANDLE_SIZE, LEN_SIZE);
-    
-    /* Stores the return value of tfs_read() */
-    ssize_t ret;
-    ret = tfs_read(fhandle, args + SESSION_ID_SIZE + FHANDLE_SIZE + LEN_SIZE, len);
 
-    /* If for some reason tfs_read() returns -1, it won't be a problem for now,
-     * as the client will deal with it accordingly */
-    if (write_until_success(client_fd, &ret, RDWR_VAL_SIZE) != 0) {
+    /* The reply flows as back-to-back chunks of at most MAX_RDWR_SIZE:
+     * each chunk is the byte count followed by the data itself, shipped
+     * by tfs_read_to_fd() straight from the file's data block into the
+     * client's pipe with no staging buffer in between. There is no
+     * per-chunk acknowledgment, and a short chunk tells the client the
+     * file's end was reached. A request of up to one block produces a
+     * single chunk, just like before */
+    size_t remaining = len;
+
+    while (1) {
+        size_t want = remaining;
+        if (want > MAX_RDWR_SIZE) {
+            want = MAX_RDWR_SIZE;
+        }
+
+        ssize_t ret;
+        if (IS_SHM_DEST(client_fd)) {
+            /* Shared-memory sessions have no pipe to splice into, so the
+             * chunk goes through a staging buffer and into the reply
+             * ring: the count first, then the data */
+            char chunk[MAX_RDWR_SIZE];
+            ret = tfs_read(fhandle, chunk, want);
+            if (ret != -1) {
+                if (client_reply(client_fd, &ret, RDWR_VAL_SIZE) != 0) {
+                    return;
+                }
+                if (ret > 0 && client_reply(client_fd, chunk, (size_t)ret) != 0) {
+                    return;
+                }
+            }
+        } else {
+            ret = tfs_read_to_fd(fhandle, client_fd, want);
+        }
+
+        if (ret == -1) {
+            /* Nothing went out for this chunk: a -1 count (best effort)
+             * unblocks the client, which will deal with it accordingly */
+            ssize_t err = -1;
+            client_reply(client_fd, &err, RDWR_VAL_SIZE);
+            return;
+        }
+
+        if (ret < (ssize_t)want) {
+            /* End of file: the stream is over */
+            return;
+        }
+
+        remaining -= (size_t)ret;
+        if (remaining == 0) {
+            return;
+        }
+    }
+}
+
+
+/*
+ * Compound open+write+close: creates (or truncates) the file, writes the
+ * request's payload and closes it, all in one dispatch, so the client
+ * pays a single round trip instead of three.
+ * Buffer structure: client_fd | <file name> | len | data
+ */
+void tfs_server_put(void const *arg) {
+    char *args = (char*) arg;
+
+    int client_fd;
+    memcpy(&client_fd, args, CLIENT_FD_SIZE);
+    char file_name[MAX_CPATH_LEN];
+    memcpy(file_name, args + SESSION_ID_SIZE, MAX_CPATH_LEN);
+    size_t len;
+    memcpy(&len, args + SESSION_ID_SIZE + MAX_CPATH_LEN, LEN_SIZE);
+    char *data = args + SESSION_ID_SIZE + MAX_CPATH_LEN + LEN_SIZE;
+
+    ssize_t ret = -1;
+    if (len <= MAX_RDWR_SIZE) {
+        int fhandle = tfs_open(file_name, TFS_O_CREAT | TFS_O_TRUNC);
+        if (fhandle != -1) {
+            ret = tfs_write(fhandle, data, len);
+            if (tfs_close(fhandle) != 0) {
+                ret = -1;
+            }
+        }
+    }
+
+    if (client_reply(client_fd, &ret, RDWR_VAL_SIZE) != 0) {
+        if (send_message(client_fd, -1) != 0) {
+            exit(1);
+        }
+        return;
+    }
+}
+
+/*
+ * Compound open+read+close: opens the file, streams up to "len" bytes
+ * (one block at most, which is all a file can hold) straight into the
+ * client's pipe via tfs_read_to_fd(), and closes it.
+ * Buffer structure: client_fd | <file name> | len
+ */
+void tfs_server_get(void const *arg) {
+    char *args = (char*) arg;
+
+    int client_fd;
+    memcpy(&client_fd, args, CLIENT_FD_SIZE);
+    char file_name[MAX_CPATH_LEN];
+    memcpy(file_name, args + SESSION_ID_SIZE, MAX_CPATH_LEN);
+    size_t len;
+    memcpy(&len, args + SESSION_ID_SIZE + MAX_CPATH_LEN, LEN_SIZE);
+
+    int fhandle = tfs_open(file_name, 0);
+    if (fhandle == -1) {
+        ssize_t err = -1;
+        client_reply(client_fd, &err, RDWR_VAL_SIZE);
+        return;
+    }
+
+    size_t want = len;
+    if (want > MAX_RDWR_SIZE) {
+        want = MAX_RDWR_SIZE;
+    }
+
+    if (IS_SHM_DEST(client_fd)) {
+        char chunk[MAX_RDWR_SIZE];
+        ssize_t ret = tfs_read(fhandle, chunk, want);
+        if (client_reply(client_fd, &ret, RDWR_VAL_SIZE) == 0 && ret > 0) {
+            client_reply(client_fd, chunk, (size_t)ret);
+        }
+    } else if (tfs_read_to_fd(fhandle, client_fd, want) == -1) {
+        ssize_t err = -1;
+        client_reply(client_fd, &err, RDWR_VAL_SIZE);
+    }
+
+    tfs_close(fhandle);
+}
+
+void tfs_server_stats(void const *arg) {
+    char *args = (char*) arg;
+
+    /* Gets the arguments we need for the stats command:
+     * client_fd */
+    int client_fd;
+    memcpy(&client_fd, args, CLIENT_FD_SIZE);
+
+    /* The statistics go back as one tfs_stats struct: both ends run on
+     * the same machine, so the in-memory layout is the wire format */
+    tfs_stats stats;
+    if (tfs_get_stats(&stats) == -1) {
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    if (client_reply(client_fd, &stats, sizeof(tfs_stats)) != 0) {
         if (send_message(client_fd, -1) != 0) {
             exit(1);
         }
@@ -469,7 +1000,7 @@ void tfs_server_shutdown(void const *arg) {
 
     /* If for some reason tfs_destroy_after_all_closed() returns -1, it won't 
      * be a problem for now, as the client will deal with it accordingly */
-    if (write_until_success(client_fd, &ret, RETURN_VAL_SIZE) != 0) {
+    if (client_reply(client_fd, &ret, RETURN_VAL_SIZE) != 0) {
         if (send_message(client_fd, -1) != 0) {
             exit(1);
         }
@@ -478,6 +1009,176 @@ void tfs_server_shutdown(void const *arg) {
 }
 
 
+/*
+ * Worker thread routine: each session has one worker, which loops
+ * popping requests off the session's queue and executing them. Requests
+ * from different sessions run concurrently, while requests from the same
+ * session keep their arrival order.
+ * Inputs:
+ *  - the session this worker serves
+ */
+void *session_worker(void *arg) {
+    client_session_t *session = (client_session_t *)arg;
+
+    while (1) {
+        char *request = session_queue_pop(session);
+        if (request == NULL) {
+            exit(1);
+        }
+
+        char op_code = request[0];
+
+        switch (op_code) {
+            /* "request+OP_CODE_SIZE" is used to skip the OP_CODE */
+
+            case TFS_OP_CODE_UNMOUNT:
+                tfs_server_unmount(request + OP_CODE_SIZE);
+                break;
+
+            case TFS_OP_CODE_OPEN:
+                tfs_server_open(request + OP_CODE_SIZE);
+                break;
+
+            case TFS_OP_CODE_CLOSE:
+                tfs_server_close(request + OP_CODE_SIZE);
+                break;
+
+            case TFS_OP_CODE_WRITE:
+                tfs_server_write(session, request + OP_CODE_SIZE);
+                break;
+
+            case TFS_OP_CODE_READ:
+                tfs_server_read(request + OP_CODE_SIZE);
+                break;
+
+            case TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED:
+                tfs_server_shutdown(request + OP_CODE_SIZE);
+                break;
+
+            case TFS_OP_CODE_OPEN_WRITE_CLOSE:
+                tfs_server_put(request + OP_CODE_SIZE);
+                break;
+
+            case TFS_OP_CODE_OPEN_READ_CLOSE:
+                tfs_server_get(request + OP_CODE_SIZE);
+                break;
+
+            case TFS_OP_CODE_STATS:
+                tfs_server_stats(request + OP_CODE_SIZE);
+                break;
+
+            default:
+                printf("Invalid OP_CODE\n");
+                break;
+        }
+
+        /* The request has been fully handled: its slot can be recycled */
+        if (session_slot_free(session, request) != 0) {
+            exit(1);
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Receiver thread of a pipe session: reads framed requests off the
+ * session's private request pipe into the session's slots and hands them
+ * to the session's worker. The session id in each request is replaced by
+ * the client's reply pipe fd, like the old central receive loop did;
+ * unmount is the exception, as its handler needs the id itself. Exits
+ * (and closes the pipe) once the client closes its end at unmount.
+ * Inputs:
+ *  - the session this receiver serves
+ */
+void *pipe_session_receiver(void *arg) {
+    client_session_t *session = (client_session_t *)arg;
+
+    /* Saved locally: the session's entry may be freed and reused by
+     * unmount while this thread is still draining */
+    int request_fd = session->request_fd;
+    int client_fd = session->client_fd;
+
+    while (1) {
+        char *request_buffer = session_slot_alloc(session);
+        if (request_buffer == NULL) {
+            exit(1);
+        }
+
+        ssize_t rd = read_framed(request_fd, request_buffer, MAX_REQUEST_SIZE);
+        if (rd <= 0) {
+            /* The client closed its end: the session is over */
+            session_slot_free(session, request_buffer);
+            break;
+        }
+
+        char op_code = request_buffer[0];
+
+        if (op_code != TFS_OP_CODE_UNMOUNT) {
+            memcpy(request_buffer + OP_CODE_SIZE, &client_fd, CLIENT_FD_SIZE);
+        }
+
+        if (session_queue_push(session, request_buffer) != 0) {
+            exit(1);
+        }
+    }
+
+    close_until_success(request_fd);
+    return NULL;
+}
+
+
+/*
+ * Receiver thread of a shared-memory session: the per-session twin of
+ * the main receive loop, pulling framed requests off the session's
+ * request ring into pool slots and handing them to the session's worker.
+ * The session id in each request is replaced by the session's encoded
+ * shm destination (see SHM_DEST), so the handlers reply to the right
+ * place; unmount is the exception, as its handler needs the id itself.
+ * Exits (and unmaps the channel) once the client closes the channel.
+ * Inputs:
+ *  - the session this receiver serves
+ */
+void *shm_session_receiver(void *arg) {
+    client_session_t *session = (client_session_t *)arg;
+    int session_id = session->session_id;
+
+    /* The channel outlives the session's entry (which may be freed and
+     * reused by unmount), so it is saved locally for the final unmap */
+    shm_channel_t *channel = session->shm;
+
+    while (1) {
+        char *request_buffer = session_slot_alloc(session);
+        if (request_buffer == NULL) {
+            exit(1);
+        }
+
+        ssize_t rd = shm_ring_read_framed(&channel->request_ring,
+                                          request_buffer, MAX_REQUEST_SIZE);
+        if (rd <= 0) {
+            /* The client closed the channel: the session is over */
+            session_slot_free(session, request_buffer);
+            break;
+        }
+
+        char op_code = request_buffer[0];
+
+        if (op_code != TFS_OP_CODE_UNMOUNT) {
+            int dest = SHM_DEST(session_id);
+            memcpy(request_buffer + OP_CODE_SIZE, &dest, CLIENT_FD_SIZE);
+        }
+
+        if (session_queue_push(session, request_buffer) != 0) {
+            exit(1);
+        }
+    }
+
+    munmap(channel, sizeof(shm_channel_t));
+    return NULL;
+}
+
+
 int main(int argc, char **argv) {
     if (argc < 2) {
         printf("Please specify the pathname of the server's pipe.\n");
@@ -497,106 +1198,40 @@ int main(int argc, char **argv) {
         return -1;
     }
 
-    /* The server will run indefinitely, waiting for requests from the clients */
+    /* The server will run indefinitely, waiting for mounts from the
+     * clients: everything after a mount flows through the session's own
+     * request pipe (or shm channel) and its receiver thread, so the
+     * server's pipe never becomes anyone's bottleneck */
     while(1) {
-        /* Buffer that stores request's fields (OP_CODE + rest of the fields) */
         char request_buffer[MAX_REQUEST_SIZE];
 
-        ssize_t offset = 0, rd;
-        while ((rd = read_until_success(server_fd, request_buffer + offset, MAX_REQUEST_SIZE)) !=
-                                                                MAX_REQUEST_SIZE && errno == EINTR) {
-            /* "Reboots" the server if needed */
-            if (rd <= 0) {
-                if (close_until_success(server_fd) != 0) {
-                    exit(1);
-                }
-                server_fd = open_until_success(pipename, O_RDONLY);
-                if (server_fd == -1) {
-                    exit(1);
-                }
-            }
-            /* Updates the current offset */
-            offset += rd;
-        }
-        
-        client_session_t *client_session;
-        char op_code = request_buffer[0];
-
-        int session_id = -1;
-        /* Gets the client's session id from the buffer */
-        memcpy(request_buffer + OP_CODE_SIZE, &session_id, SESSION_ID_SIZE);
-
-        if (op_code != TFS_OP_CODE_MOUNT || op_code != TFS_OP_CODE_UNMOUNT) {
-            /* Protect the session_get function call */
-            if (pthread_mutex_lock(&server_mutex) != 0) {
+        ssize_t rd = read_framed(server_fd, request_buffer, MAX_REQUEST_SIZE);
+        if (rd <= 0) {
+            /* "Reboots" the server's pipe: every client closed (or the
+             * stream broke), so reopen and wait for new ones */
+            if (close_until_success(server_fd) != 0) {
                 exit(1);
             }
-
-            client_session = session_get(session_id);
-            if (client_session == NULL) {
+            server_fd = open_until_success(pipename, O_RDONLY);
+            if (server_fd == -1) {
                 exit(1);
             }
-
-            int client_fd = client_session->client_fd;
-
-            if (pthread_mutex_unlock(&server_mutex) != 0) {
-                exit(1);
-            }
-
-            /* replaces the "session_id" in the buffer with the client's file descriptor, to be
-             * used by the server to connect to the client's pipe on future function calls, write,
-             * read, open, close and shutdown */
-            memcpy(request_buffer + OP_CODE_SIZE, &client_fd, CLIENT_FD_SIZE);
+            continue;
         }
 
-        switch(op_code) {
-            /* "request_buffer+1" is used to skip the OP_CODE */
-
-            case TFS_OP_CODE_MOUNT:
-                tfs_server_mount(request_buffer+OP_CODE_SIZE);
-                break;
-            
-            case TFS_OP_CODE_UNMOUNT:
-                session_cond_wait(client_session);
-                pthread_create(&session_thread_table[session_id], NULL, (void*)tfs_server_unmount, request_buffer+OP_CODE_SIZE);
-                session_cond_signal(client_session);
-                break;
-            
-            case TFS_OP_CODE_OPEN:
-                session_cond_wait(client_session);
-                pthread_create(&session_thread_table[session_id], NULL, (void*)tfs_server_open, request_buffer+OP_CODE_SIZE);
-                session_cond_signal(client_session);
-                break;
-
-            case TFS_OP_CODE_CLOSE:
-                session_cond_wait(client_session);
-                pthread_create(&session_thread_table[session_id], NULL, (void*)tfs_server_close, request_buffer+OP_CODE_SIZE);
-                session_cond_signal(client_session);
-                break;
-
-            case TFS_OP_CODE_WRITE:
-                session_cond_wait(client_session);
-                pthread_create(&session_thread_table[session_id], NULL, (void*)tfs_server_write, request_buffer+OP_CODE_SIZE);
-                session_cond_signal(client_session);
-                break;
-
-            case TFS_OP_CODE_READ:
-                session_cond_wait(client_session);
-                pthread_create(&session_thread_table[session_id], NULL, (void*)tfs_server_read, request_buffer+OP_CODE_SIZE);
-                session_cond_signal(client_session);
-                break;
+        char op_code = request_buffer[0];
 
-            case TFS_OP_CODE_SHUTDOWN_AFTER_ALL_CLOSED:
-                session_cond_wait(client_session);
-                pthread_create(&session_thread_table[session_id], NULL, (void*)tfs_server_shutdown, request_buffer+OP_CODE_SIZE);
-                session_cond_signal(client_session);
-                break;
+        if (op_code == TFS_OP_CODE_MOUNT) {
+            tfs_server_mount(request_buffer + OP_CODE_SIZE);
+            continue;
+        }
 
-            default:
-                /* Esta entrega...kinda embarassing ngl, sry :c */
-                printf("Invalid OP_CODE\n");
-                break;
+        if (op_code == TFS_OP_CODE_MOUNT_SHM) {
+            tfs_server_mount_shm(request_buffer + OP_CODE_SIZE);
+            continue;
         }
+
+        printf("Invalid OP_CODE\n");
     }
 
     return 0;
@@ -0,0 +1,251 @@
+#include "client/tecnicofs_client_api.h"
+#include <stdio.h>
+#include <time.h>
+
+/*  Benchmark harness for the client/server path: forks a configurable
+    number of client processes, each with its own session, and drives a
+    mix of one-round-trip puts and gets against a running tfs_server,
+    reporting ops/sec and latency percentiles per operation type. Each
+    child sends its latency samples back over a plain pipe and the parent
+    merges them for the report.
+
+    Usage: bench_client client_pipe server_pipe
+                        [clients [files [bytes [write_pct [ops]]]]]
+
+    The server must already be running (the `make bench` target takes
+    care of that). */
+
+/* The default workload keeps clients * files at 20: the root directory
+ * is a single block of 44-byte entries, so the whole server holds at
+ * most 23 files */
+#define DEFAULT_CLIENTS (4)
+#define DEFAULT_FILES (5)
+#define DEFAULT_BYTES (1024)
+#define DEFAULT_WRITE_PCT (50)
+#define DEFAULT_OPS (1000)
+
+static int n_files;
+static int n_bytes;
+static int write_pct;
+static int n_ops;
+
+static long elapsed_ns(struct timespec const *t0, struct timespec const *t1) {
+    return (t1->tv_sec - t0->tv_sec) * 1000000000L +
+           (t1->tv_nsec - t0->tv_nsec);
+}
+
+/* What each child reports back to the parent, followed by the two
+ * latency sample arrays (write_count, then read_count, longs) */
+typedef struct {
+    long elapsed;
+    size_t write_count;
+    size_t read_count;
+} bench_report_t;
+
+static int run_client(int index, char const *client_pipe_base,
+                      char const *server_pipe, int report_fd) {
+    char client_pipe[MAX_CPATH_LEN];
+    char path[MAX_CPATH_LEN];
+    char buffer[MAX_RDWR_SIZE];
+
+    snprintf(client_pipe, sizeof(client_pipe), "%.*s%d",
+             MAX_CPATH_LEN - 12, client_pipe_base, index);
+
+    if (tfs_mount(client_pipe, server_pipe) != 0) {
+        return 1;
+    }
+
+    memset(buffer, 'A' + (char)(index % 26), sizeof(buffer));
+
+    /* Setup (untimed): creates this client's files at full size */
+    for (int i = 0; i < n_files; i++) {
+        snprintf(path, sizeof(path), "/b%d_%d", index, i);
+        if (tfs_client_put(path, buffer, (size_t)n_bytes) != n_bytes) {
+            return 1;
+        }
+    }
+
+    long *write_ns = malloc((size_t)n_ops * sizeof(long));
+    long *read_ns = malloc((size_t)n_ops * sizeof(long));
+    if (write_ns == NULL || read_ns == NULL) {
+        return 1;
+    }
+
+    bench_report_t report = {0};
+    unsigned int seed = (unsigned int)(index + 1);
+    struct timespec run_t0;
+    struct timespec run_t1;
+    struct timespec t0;
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &run_t0);
+
+    for (int op = 0; op < n_ops; op++) {
+        int file = (int)((unsigned int)rand_r(&seed) % (unsigned int)n_files);
+        int is_write =
+            (int)((unsigned int)rand_r(&seed) % 100u) < write_pct;
+
+        snprintf(path, sizeof(path), "/b%d_%d", index, file);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (is_write) {
+            if (tfs_client_put(path, buffer, (size_t)n_bytes) != n_bytes) {
+                return 1;
+            }
+        } else {
+            if (tfs_client_get(path, buffer, (size_t)n_bytes) != n_bytes) {
+                return 1;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        if (is_write) {
+            write_ns[report.write_count++] = elapsed_ns(&t0, &t1);
+        } else {
+            read_ns[report.read_count++] = elapsed_ns(&t0, &t1);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &run_t1);
+    report.elapsed = elapsed_ns(&run_t0, &run_t1);
+
+    if (tfs_unmount() != 0) {
+        return 1;
+    }
+
+    if (write_until_success(report_fd, &report, sizeof(report)) == -1 ||
+        write_until_success(report_fd, write_ns,
+                            report.write_count * sizeof(long)) == -1 ||
+        write_until_success(report_fd, read_ns,
+                            report.read_count * sizeof(long)) == -1) {
+        return 1;
+    }
+
+    return 0;
+}
+
+static int cmp_long(void const *a, void const *b) {
+    long la = *(long const *)a;
+    long lb = *(long const *)b;
+    return (la > lb) - (la < lb);
+}
+
+static long percentile(long const *sorted, size_t count, int pct) {
+    if (count == 0) {
+        return 0;
+    }
+    size_t index = (count * (size_t)pct + 99) / 100;
+    if (index > 0) {
+        index--;
+    }
+    return sorted[index];
+}
+
+static void print_report(char const *name, long *ns, size_t count,
+                         double seconds) {
+    qsort(ns, count, sizeof(long), cmp_long);
+
+    printf("%-7s %8zu ops  %10.0f ops/s  "
+           "p50 %6.1f us  p95 %6.1f us  p99 %6.1f us\n",
+           name, count, (double)count / seconds,
+           (double)percentile(ns, count, 50) / 1000.0,
+           (double)percentile(ns, count, 95) / 1000.0,
+           (double)percentile(ns, count, 99) / 1000.0);
+}
+
+int main(int argc, char **argv) {
+
+    if (argc < 3) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path [clients [files [bytes [write_pct "
+               "[ops]]]]]'\n");
+        return 1;
+    }
+
+    int n_clients = (argc > 3) ? atoi(argv[3]) : DEFAULT_CLIENTS;
+    n_files = (argc > 4) ? atoi(argv[4]) : DEFAULT_FILES;
+    n_bytes = (argc > 5) ? atoi(argv[5]) : DEFAULT_BYTES;
+    write_pct = (argc > 6) ? atoi(argv[6]) : DEFAULT_WRITE_PCT;
+    n_ops = (argc > 7) ? atoi(argv[7]) : DEFAULT_OPS;
+
+    if (n_clients < 1 || n_files < 1 || n_bytes < 1 ||
+        n_bytes > MAX_RDWR_SIZE || write_pct < 0 || write_pct > 100 ||
+        n_ops < 1) {
+        printf("Invalid workload parameters\n");
+        return 1;
+    }
+
+    pid_t pids[n_clients];
+    int report_fds[n_clients];
+
+    for (int i = 0; i < n_clients; i++) {
+        int report_pipe[2];
+        if (pipe(report_pipe) == -1) {
+            return 1;
+        }
+
+        pids[i] = fork();
+        if (pids[i] == -1) {
+            return 1;
+        }
+
+        if (pids[i] == 0) {
+            close(report_pipe[0]);
+            _exit(run_client(i, argv[1], argv[2], report_pipe[1]));
+        }
+
+        close(report_pipe[1]);
+        report_fds[i] = report_pipe[0];
+    }
+
+    /* Merges every child's samples; throughput is measured over the
+     * slowest client's run, since the runs overlap */
+    size_t max_samples = (size_t)n_clients * (size_t)n_ops;
+    long *write_ns = malloc(max_samples * sizeof(long));
+    long *read_ns = malloc(max_samples * sizeof(long));
+    if (write_ns == NULL || read_ns == NULL) {
+        return 1;
+    }
+
+    size_t write_count = 0;
+    size_t read_count = 0;
+    long slowest = 0;
+
+    for (int i = 0; i < n_clients; i++) {
+        bench_report_t report;
+        if (read_until_success(report_fds[i], &report, sizeof(report)) == -1 ||
+            read_until_success(report_fds[i], write_ns + write_count,
+                               report.write_count * sizeof(long)) == -1 ||
+            read_until_success(report_fds[i], read_ns + read_count,
+                               report.read_count * sizeof(long)) == -1) {
+            printf("Client %d did not report back\n", i);
+            return 1;
+        }
+        close(report_fds[i]);
+
+        write_count += report.write_count;
+        read_count += report.read_count;
+        if (report.elapsed > slowest) {
+            slowest = report.elapsed;
+        }
+    }
+
+    for (int i = 0; i < n_clients; i++) {
+        int status;
+        if (waitpid(pids[i], &status, 0) != pids[i] || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0) {
+            printf("Client %d failed\n", i);
+            return 1;
+        }
+    }
+
+    double seconds = (double)slowest / 1e9;
+
+    printf("bench: %d clients, %d files x %d bytes each, %d%% writes, "
+           "%.3fs\n",
+           n_clients, n_files, n_bytes, write_pct, seconds);
+    print_report("puts", write_ns, write_count, seconds);
+    print_report("gets", read_ns, read_count, seconds);
+
+    return 0;
+}
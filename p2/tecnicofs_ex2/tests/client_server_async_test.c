@@ -0,0 +1,97 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/*  Exercises the pipelined write API: a full pipeline of writes goes out
+    before the first reply is collected, completions are picked up both
+    by handle (out of submission order) and with tfs_wait_any, and a
+    synchronous call with writes still in flight drains them first. */
+
+#define PIECE (100)
+
+int main(int argc, char **argv) {
+
+    char *path = "/f1";
+    char piece[PIECE];
+    char buffer[TFS_ASYNC_MAX * PIECE + 1];
+
+    int handles[TFS_ASYNC_MAX];
+    ssize_t r;
+
+    if (argc < 3) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path'\n");
+        return 1;
+    }
+
+    assert(tfs_mount(argv[1], argv[2]) == 0);
+
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+
+    /* Fills the whole pipeline before collecting anything */
+    for (int i = 0; i < TFS_ASYNC_MAX; i++) {
+        memset(piece, 'A' + i, PIECE);
+        handles[i] = tfs_write_async(f, piece, PIECE);
+        assert(handles[i] != -1);
+    }
+
+    /* Collects the completions in reverse submission order: the results
+       have to land on the right handles regardless */
+    for (int i = TFS_ASYNC_MAX - 1; i >= 0; i--) {
+        assert(tfs_wait(handles[i]) == PIECE);
+    }
+
+    /* A waited handle is gone */
+    assert(tfs_wait(handles[0]) == -1);
+
+    assert(tfs_close(f) == 0);
+
+    /* The writes were applied in submission order */
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    r = tfs_read(f, buffer, sizeof(buffer) - 1);
+    assert(r == TFS_ASYNC_MAX * PIECE);
+    for (int i = 0; i < TFS_ASYNC_MAX; i++) {
+        memset(piece, 'A' + i, PIECE);
+        assert(memcmp(buffer + i * PIECE, piece, PIECE) == 0);
+    }
+    assert(tfs_close(f) == 0);
+
+    /* Round two: collected with tfs_wait_any until nothing is left */
+    f = tfs_open(path, TFS_O_TRUNC);
+    assert(f != -1);
+
+    memset(piece, 'x', PIECE);
+    for (int i = 0; i < TFS_ASYNC_MAX / 2; i++) {
+        assert(tfs_write_async(f, piece, PIECE) != -1);
+    }
+    for (int i = 0; i < TFS_ASYNC_MAX / 2; i++) {
+        assert(tfs_wait_any(&r) != -1);
+        assert(r == PIECE);
+    }
+    assert(tfs_wait_any(&r) == -1);
+
+    /* A synchronous call with writes still in flight drains them first,
+       so its reply is its own */
+    assert(tfs_write_async(f, piece, PIECE) != -1);
+    assert(tfs_write_async(f, piece, PIECE) != -1);
+
+    r = tfs_read(f, buffer, sizeof(buffer) - 1);
+    assert(r == 0); /* the offset sits at the end of the file */
+
+    /* Their results are still collectable afterwards */
+    assert(tfs_wait_any(&r) != -1);
+    assert(r == PIECE);
+    assert(tfs_wait_any(&r) != -1);
+    assert(r == PIECE);
+
+    assert(tfs_close(f) == 0);
+
+    assert(tfs_unmount() == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/*  Exercises the compound operations: a whole file written with a single
+    tfs_client_put call and read back with a single tfs_client_get call,
+    plus the interesting error cases. */
+
+int main(int argc, char **argv) {
+
+    char *str = "Compound operations, one round trip!";
+    char *path = "/f1";
+    char buffer[64];
+
+    ssize_t r;
+
+    if (argc < 3) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path'\n");
+        return 1;
+    }
+
+    assert(tfs_mount(argv[1], argv[2]) == 0);
+
+    /* One call creates, writes and closes the file */
+    r = tfs_client_put(path, str, strlen(str));
+    assert(r == strlen(str));
+
+    /* One call opens, reads and closes it */
+    r = tfs_client_get(path, buffer, sizeof(buffer) - 1);
+    assert(r == strlen(str));
+    buffer[r] = '\0';
+    assert(strcmp(buffer, str) == 0);
+
+    /* Putting again truncates: the old contents don't linger */
+    char *str2 = "shorter";
+    r = tfs_client_put(path, str2, strlen(str2));
+    assert(r == strlen(str2));
+
+    r = tfs_client_get(path, buffer, sizeof(buffer) - 1);
+    assert(r == strlen(str2));
+    buffer[r] = '\0';
+    assert(strcmp(buffer, str2) == 0);
+
+    /* Getting a file that doesn't exist fails cleanly, and the session
+       stays usable afterwards */
+    assert(tfs_client_get("/missing", buffer, sizeof(buffer)) == -1);
+
+    r = tfs_client_get(path, buffer, sizeof(buffer) - 1);
+    assert(r == strlen(str2));
+
+    assert(tfs_unmount() == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/*  Mounts more concurrent sessions than a single table segment holds
+    (forcing the server to grow the session table), half of them over
+    shared memory and half over the pipe transport with its per-session
+    request pipe. Every client is a forked process doing a full
+    put/get/unmount round, so the sessions are genuinely simultaneous.
+    (Capped at MAX_OPEN_FILES: each client briefly holds a file open,
+    and the open file table is a limit of the filesystem, not of the
+    session layer under test.) */
+
+#define CLIENTS (20)
+
+static int run_client(int index, char const *client_pipe_base,
+                      char const *server_pipe) {
+    char client_pipe[MAX_CPATH_LEN];
+    char path[MAX_CPATH_LEN];
+    char content[64];
+    char buffer[64];
+
+    snprintf(client_pipe, sizeof(client_pipe), "%.*s%d",
+             MAX_CPATH_LEN - 4, client_pipe_base, index);
+    snprintf(path, sizeof(path), "/f%d", index);
+    snprintf(content, sizeof(content), "session number %d says hi", index);
+
+    /* Half the clients force the pipe transport, the other half take the
+       preferred shared-memory one */
+    if (index % 2 == 0) {
+        if (tfs_mount(client_pipe, server_pipe) != 0) {
+            return 1;
+        }
+    } else {
+        if (tfs_mount_pipes(client_pipe, server_pipe) != 0) {
+            return 1;
+        }
+    }
+
+    ssize_t r = tfs_client_put(path, content, strlen(content));
+    if (r != (ssize_t)strlen(content)) {
+        return 1;
+    }
+
+    r = tfs_client_get(path, buffer, sizeof(buffer) - 1);
+    if (r != (ssize_t)strlen(content)) {
+        return 1;
+    }
+    buffer[r] = '\0';
+    if (strcmp(buffer, content) != 0) {
+        return 1;
+    }
+
+    if (tfs_unmount() != 0) {
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+
+    pid_t pids[CLIENTS];
+
+    if (argc < 3) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path'\n");
+        return 1;
+    }
+
+    for (int i = 0; i < CLIENTS; i++) {
+        pids[i] = fork();
+        assert(pids[i] != -1);
+
+        if (pids[i] == 0) {
+            _exit(run_client(i, argv[1], argv[2]));
+        }
+    }
+
+    for (int i = 0; i < CLIENTS; i++) {
+        int status;
+        assert(waitpid(pids[i], &status, 0) == pids[i]);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/*  Exercises the shared-memory transport: tfs_mount prefers it whenever
+    the shm channel can be negotiated, so a full session here (open,
+    write, read, close, the compound put/get, unmount) runs over the
+    rings instead of the pipes. A second mount afterwards checks the
+    session and segment teardown left everything reusable. */
+
+int main(int argc, char **argv) {
+
+    char *str = "One full session over shared memory!";
+    char *path = "/f1";
+    char buffer[64];
+
+    ssize_t r;
+
+    if (argc < 3) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path'\n");
+        return 1;
+    }
+
+    assert(tfs_mount(argv[1], argv[2]) == 0);
+
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+
+    r = tfs_write(f, str, strlen(str));
+    assert(r == strlen(str));
+
+    assert(tfs_close(f) == 0);
+
+    f = tfs_open(path, 0);
+    assert(f != -1);
+
+    r = tfs_read(f, buffer, sizeof(buffer) - 1);
+    assert(r == strlen(str));
+    buffer[r] = '\0';
+    assert(strcmp(buffer, str) == 0);
+
+    assert(tfs_close(f) == 0);
+
+    /* The compound operations flow through the rings too */
+    char *str2 = "put and get, same rings";
+    r = tfs_client_put("/f2", str2, strlen(str2));
+    assert(r == strlen(str2));
+
+    r = tfs_client_get("/f2", buffer, sizeof(buffer) - 1);
+    assert(r == strlen(str2));
+    buffer[r] = '\0';
+    assert(strcmp(buffer, str2) == 0);
+
+    /* Errors come back over the rings without wedging the session */
+    assert(tfs_client_get("/missing", buffer, sizeof(buffer)) == -1);
+
+    assert(tfs_unmount() == 0);
+
+    /* Mounting again gets a fresh session (and a fresh segment): the
+       previous teardown can't have leaked either */
+    assert(tfs_mount(argv[1], argv[2]) == 0);
+
+    r = tfs_client_get("/f2", buffer, sizeof(buffer) - 1);
+    assert(r == strlen(str2));
+    buffer[r] = '\0';
+    assert(strcmp(buffer, str2) == 0);
+
+    assert(tfs_unmount() == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
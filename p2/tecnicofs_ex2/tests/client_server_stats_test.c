@@ -0,0 +1,62 @@
+#include "client/tecnicofs_client_api.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/*  Fetches the server's statistics before and after a known batch of
+    operations and checks the counters moved by at least that much.
+    Other sessions may be running against the same server, so only
+    deltas (and sanity bounds) are asserted, never absolute values. */
+
+int main(int argc, char **argv) {
+
+    char *str = "stats test contents";
+    char *path = "/f_stats";
+    char buffer[64];
+
+    if (argc < 3) {
+        printf("You must provide the following arguments: 'client_pipe_path "
+               "server_pipe_path'\n");
+        return 1;
+    }
+
+    assert(tfs_mount(argv[1], argv[2]) == 0);
+
+    tfs_stats before;
+    assert(tfs_client_stats(&before) == 0);
+    assert(before.inodes_total > 0);
+    assert(before.data_blocks_total > 0);
+    assert(before.open_files_total > 0);
+
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, str, strlen(str)) == strlen(str));
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == strlen(str));
+    assert(tfs_close(f) != -1);
+
+    tfs_stats after;
+    assert(tfs_client_stats(&after) == 0);
+    assert(after.open_calls >= before.open_calls + 2);
+    assert(after.close_calls >= before.close_calls + 2);
+    assert(after.write_calls >= before.write_calls + 1);
+    assert(after.read_calls >= before.read_calls + 1);
+    assert(after.bytes_written >= before.bytes_written + strlen(str));
+    assert(after.bytes_read >= before.bytes_read + strlen(str));
+
+    /* At least the root directory and /f_stats are allocated by now */
+    assert(after.inodes_used >= 2);
+    assert(after.inodes_used <= after.inodes_total);
+    assert(after.data_blocks_used >= 1);
+    assert(after.data_blocks_used <= after.data_blocks_total);
+    assert(after.open_files_used <= after.open_files_total);
+
+    assert(tfs_unmount() == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}